@@ -17,11 +17,22 @@
 #ifndef RISC_V_SIMULATOR_INCLUDE_ALU_H
 #define RISC_V_SIMULATOR_INCLUDE_ALU_H
 
+#include "config.h"
 #include "instructions.h"
 #include "type.h"
 
+/**
+ * @class ALU
+ * A pipelined ALU.  An instruction gives its result after its latency, and
+ * the next one may start after its interval.  The results in flight are kept
+ * by the cycle they come out in, and an instruction is not started if its
+ * result would come out together with an earlier one, so that at most one
+ * result comes out in a cycle.
+ */
 class ALU {
 public:
+    constexpr static SizeType kMaxLatency = 16;
+
     ALU() = default;
     ALU(const ALU&) = default;
     ALU(ALU&&) = default;
@@ -32,13 +43,13 @@ public:
     ~ALU() = default;
 
     /**
-     * Tell whether the ALU is running.
+     * Tell whether an instruction can be started in this cycle.
+     * @param timing the timing of the instruction
      */
-    [[nodiscard]] bool Busy() const;
+    [[nodiscard]] bool Ready(const Timing& timing) const;
 
     /**
-     * Tell whether the ALU have just finish calculating.
-     * @return
+     * Tell whether a result comes out in this cycle.
      */
     [[nodiscard]] bool Finished() const;
 
@@ -54,18 +65,44 @@ public:
 
     void Clear();
 
+    /**
+     * Drop the results in flight of some inputs.
+     * @param squashed tells whether an index is dropped
+     */
+    template<class Predicate>
+    void Squash(Predicate&& squashed) {
+        for (auto& operation : pipeline) {
+            if (operation.valid && squashed(operation.index)) operation.valid = false;
+        }
+    }
+
     /**
      * Update the clock of the ALU.
      */
     void Flush();
 
 protected:
-    bool busy = false;
-    bool finished = false;
-    WordType result = 0;
-    WordType index = 0;
-    WordType nextResult = 0;
-    SizeType nextIndex = 0;
+    /**
+     * Start calculating a result.  Please check whether the ALU is ready
+     * before calling this function.
+     * @param value the result
+     * @param place the index of the input
+     * @param timing
+     */
+    void Start(WordType value, SizeType place, const Timing& timing);
+
+private:
+    constexpr static SizeType kStages = kMaxLatency + 1;
+
+    struct Operation {
+        bool     valid = false;
+        WordType result = 0;
+        SizeType index = 0;
+    };
+
+    Operation pipeline[kStages]; // by the cycle the result comes out in
+    SizeType  now = 0;
+    SizeType  nextStart = 0; // the cycle the next instruction may start in
 };
 
 class AddALU : public ALU {
@@ -85,11 +122,13 @@ public:
      * @param input2
      * @param place
      * @param instruction ADD & ADDI & SUB
+     * @param timing
      */
     void Execute(WordType input1,
                  WordType input2,
                  SizeType place,
-                 Instruction instruction);
+                 Instruction instruction,
+                 const Timing& timing);
 };
 
 class ShiftALU : public ALU {
@@ -109,11 +148,13 @@ public:
      * @param input2
      * @param place
      * @param instruction SLL & SLLI & SRL & SRLI & SRA & SRAI
+     * @param timing
      */
     void Execute(WordType input1,
                  WordType input2,
                  SizeType place,
-                 Instruction instruction);
+                 Instruction instruction,
+                 const Timing& timing);
 };
 
 class SetALU : public ALU {
@@ -133,11 +174,13 @@ public:
      * @param input2
      * @param place
      * @param instruction SLT & SLTI & SLTU & SLTIU
+     * @param timing
      */
     void Execute(WordType input1,
                  WordType input2,
                  SizeType place,
-                 Instruction instruction);
+                 Instruction instruction,
+                 const Timing& timing);
 
 };
 
@@ -158,11 +201,13 @@ public:
      * @param input2
      * @param place
      * @param instruction XOR & XORI & OR & ORI & AND & ANDI
+     * @param timing
      */
     void Execute(WordType input1,
                  WordType input2,
                  SizeType place,
-                 Instruction instruction);
+                 Instruction instruction,
+                 const Timing& timing);
 };
 
 #endif //RISC_V_SIMULATOR_INCLUDE_ALU_H
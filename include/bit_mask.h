@@ -0,0 +1,138 @@
+// RISC-V Simulator
+// Copyright (C) 2022 Lau Yee-Yu
+//
+// This library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#ifndef RISC_V_SIMULATOR_INCLUDE_BIT_MASK_H
+#define RISC_V_SIMULATOR_INCLUDE_BIT_MASK_H
+
+#include <cstdint>
+
+#include "type.h"
+
+/**
+ * @class BitMask
+ * A set of kSize bits.  The set bits are found from the lowest one by
+ * counting the trailing zeros of each word, so that a sparse mask is walked
+ * in the time of its words and its set bits.
+ */
+template<SizeType kSize>
+class BitMask {
+public:
+    constexpr static SizeType kNotFound = kSize;
+
+    BitMask() = default;
+    BitMask(const BitMask&) = default;
+    BitMask(BitMask&&) = default;
+    BitMask& operator=(const BitMask&) = default;
+    BitMask& operator=(BitMask&&) = default;
+    ~BitMask() = default;
+
+    /**
+     * Get a mask of the lowest count bits.
+     */
+    static BitMask Lowest(SizeType count) {
+        BitMask mask;
+        for (SizeType i = 0; i < kWords; ++i) {
+            if (count >= (i + 1) * 64) {
+                mask.words_[i] = ~uint64_t{0};
+            } else if (count > i * 64) {
+                mask.words_[i] = (uint64_t{1} << (count - i * 64)) - 1;
+            }
+        }
+        return mask;
+    }
+
+    void Set(SizeType index) { words_[index / 64] |= uint64_t{1} << index % 64; }
+
+    void Reset(SizeType index) { words_[index / 64] &= ~(uint64_t{1} << index % 64); }
+
+    void Clear() {
+        for (auto& word : words_) word = 0;
+    }
+
+    [[nodiscard]] bool Test(SizeType index) const { return words_[index / 64] >> index % 64 & 1; }
+
+    [[nodiscard]] SizeType Count() const {
+        SizeType count = 0;
+        for (auto word : words_) count += __builtin_popcountll(word);
+        return count;
+    }
+
+    [[nodiscard]] bool Empty() const {
+        for (auto word : words_) {
+            if (word != 0) return false;
+        }
+        return true;
+    }
+
+    /**
+     * Get the lowest set bit, or kNotFound if there is none.
+     */
+    [[nodiscard]] SizeType First() const {
+        for (SizeType i = 0; i < kWords; ++i) {
+            if (words_[i] != 0) return i * 64 + __builtin_ctzll(words_[i]);
+        }
+        return kNotFound;
+    }
+
+    /**
+     * Call f with each set bit, from the lowest one.  The bits changed by f
+     * do not change the walk.
+     * @param f
+     */
+    template<class F>
+    void ForEach(F&& f) const {
+        BitMask mask = *this;
+        for (SizeType i = 0; i < kWords; ++i) {
+            for (uint64_t word = mask.words_[i]; word != 0; word &= word - 1) {
+                f(i * 64 + __builtin_ctzll(word));
+            }
+        }
+    }
+
+    [[nodiscard]] bool operator==(const BitMask& rhs) const {
+        for (SizeType i = 0; i < kWords; ++i) {
+            if (words_[i] != rhs.words_[i]) return false;
+        }
+        return true;
+    }
+
+    BitMask& operator&=(const BitMask& rhs) {
+        for (SizeType i = 0; i < kWords; ++i) words_[i] &= rhs.words_[i];
+        return *this;
+    }
+
+    BitMask& operator|=(const BitMask& rhs) {
+        for (SizeType i = 0; i < kWords; ++i) words_[i] |= rhs.words_[i];
+        return *this;
+    }
+
+    [[nodiscard]] BitMask operator&(const BitMask& rhs) const { return BitMask(*this) &= rhs; }
+
+    [[nodiscard]] BitMask operator|(const BitMask& rhs) const { return BitMask(*this) |= rhs; }
+
+    [[nodiscard]] BitMask operator~() const {
+        BitMask mask;
+        for (SizeType i = 0; i < kWords; ++i) mask.words_[i] = ~words_[i];
+        return mask;
+    }
+
+private:
+    constexpr static SizeType kWords = (kSize + 63) / 64;
+
+    uint64_t words_[kWords] = {0};
+};
+
+#endif //RISC_V_SIMULATOR_INCLUDE_BIT_MASK_H
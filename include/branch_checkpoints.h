@@ -0,0 +1,94 @@
+// RISC-V Simulator
+// Copyright (C) 2022 Lau Yee-Yu
+//
+// This library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#ifndef RISC_V_SIMULATOR_INCLUDE_BRANCH_CHECKPOINTS_H
+#define RISC_V_SIMULATOR_INCLUDE_BRANCH_CHECKPOINTS_H
+
+#include "predictor.h"
+#include "register.h"
+#include "return_address_stack.h"
+#include "type.h"
+
+/// One bit for each unresolved branch, by the tag of its checkpoint.
+using BranchMask = uint32_t;
+
+/**
+ * @struct BranchCheckpoint
+ * The state saved when a branch is issued, which is restored if the branch
+ * is found mispredicted at execute.
+ */
+struct BranchCheckpoint {
+    RegisterFile::Checkpoint       registers;
+    ReturnAddressStack::Checkpoint stack;
+    WordType                       history = 0; // the path history of the target predictor
+    HistoryType                    branchHistory = 0; // the branch history before the branch
+    BranchMask                     olderBranches = 0; // unresolved when the branch is issued
+};
+
+/**
+ * @class BranchCheckpoints
+ * The checkpoints of the unresolved branches.  The tag of a checkpoint is a
+ * bit in the branch masks of the instructions issued after its branch, so
+ * that a misprediction drops the younger instructions by the tag and
+ * restores the state at the branch at once, however many instructions are
+ * in flight.  A checkpoint is freed when its branch is resolved, and the
+ * issue stalls at a branch while all the checkpoints are in use.
+ */
+class BranchCheckpoints {
+public:
+    constexpr static SizeType kMaxCount = 32;
+
+    /**
+     * @param count the number of checkpoints, 1 to 32
+     */
+    explicit BranchCheckpoints(SizeType count);
+    BranchCheckpoints(const BranchCheckpoints&) = default;
+    BranchCheckpoints(BranchCheckpoints&&) = default;
+
+    BranchCheckpoints& operator=(const BranchCheckpoints&) = default;
+    BranchCheckpoints& operator=(BranchCheckpoints&&) = default;
+
+    ~BranchCheckpoints() = default;
+
+    [[nodiscard]] bool Full() const;
+
+    /**
+     * Get the tags of the unresolved branches, which is the branch mask of
+     * the next instruction issued.
+     */
+    [[nodiscard]] BranchMask Active() const;
+
+    /**
+     * Take a free checkpoint.  Please check whether all the checkpoints are
+     * in use before calling this function.
+     * @param checkpoint
+     * @return the tag
+     */
+    SizeType Allocate(const BranchCheckpoint& checkpoint);
+
+    [[nodiscard]] const BranchCheckpoint& Get(SizeType tag) const;
+
+    void Free(BranchMask branches);
+
+    void Clear();
+
+private:
+    BranchMask       all_; // the tags of all the checkpoints
+    BranchMask       active_ = 0;
+    BranchCheckpoint checkpoints_[kMaxCount];
+};
+
+#endif //RISC_V_SIMULATOR_INCLUDE_BRANCH_CHECKPOINTS_H
@@ -17,6 +17,12 @@
 #ifndef RISC_V_SIMULATOR_INCLUDE_BUS_H
 #define RISC_V_SIMULATOR_INCLUDE_BUS_H
 
+#include <memory>
+#include <ostream>
+
+#include "branch_checkpoints.h"
+#include "config.h"
+#include "image.h"
 #include "instructions.h"
 #include "load_store_buffer.h"
 #include "memory.h"
@@ -26,23 +32,64 @@
 
 class Bus {
 public:
-    Bus();
-    Bus(const Bus&) = default;
-    Bus(Bus&&) = default;
-    Bus& operator=(const Bus&) = default;
-    Bus& operator=(Bus&&) = default;
+    /**
+     * Create a bus running the given image.  The image can be shared by any
+     * number of buses, each of which keeps a private copy of the pages it
+     * writes only.
+     * @param image
+     * @param config
+     */
+    Bus(std::shared_ptr<const ProgramImage> image, const Config& config);
+    Bus(const Bus&) = delete;
+    Bus(Bus&&) = delete;
+    Bus& operator=(const Bus&) = delete;
+    Bus& operator=(Bus&&) = delete;
     ~Bus() = default;
 
     void ClearPipeline();
 
-    void RegisterCommit(SizeType index, WordType value, SizeType dependency);
+    /**
+     * Recover from a branch found mispredicted at execute: drop the younger
+     * instructions, restore the register map from the checkpoint of the
+     * branch, and fetch from the correct address.
+     * @param index the RoB index of the branch
+     */
+    void RecoverBranch(SizeType index);
+
+    /**
+     * Free the checkpoints of the branches found correctly predicted.
+     * @param branches
+     */
+    void ResolveBranches(BranchMask branches);
+
+    /**
+     * Commit a write to an architectural register.
+     * @param index the architectural register
+     * @param physical the physical register holding the value
+     * @param previous the physical register to free
+     * @param moved whether it is a move eliminated at issue
+     */
+    void RegisterCommit(SizeType index, SizeType physical, SizeType previous, bool moved);
 
     void SetPC(WordType pc);
 
+    /**
+     * Run until the end instruction is committed.
+     */
     void Run();
 
+    /**
+     * Stop running at the end of this cycle.
+     * @param exitCode
+     */
+    void Halt(int exitCode);
+
+    [[nodiscard]] int ExitCode() const;
+
     [[nodiscard]] long Clock() const;
 
+    [[nodiscard]] const Config& GetConfig() const;
+
     [[nodiscard]] Memory& GetMemory();
 
     [[nodiscard]] ReorderBuffer& GetReorderBuffer();
@@ -53,14 +100,47 @@ public:
 
     [[nodiscard]] ReservationStation& GetReservationStation();
 
-    void UpdatePredictor(WordType instructionAddress, bool answer);
+    [[nodiscard]] BranchCheckpoints& GetBranchCheckpoints();
+
+    void UpdatePredictor(WordType instructionAddress, bool answer, bool prediction);
 
     [[nodiscard]] float PredictorAccuracy() const;
 
+    [[nodiscard]] Predictor& GetPredictor();
+
+    /**
+     * Apply the stack operation of a committed call or return.
+     * @param operation
+     * @param returnAddress
+     */
+    void CommitReturnAddress(StackOperation operation, WordType returnAddress);
+
+    [[nodiscard]] ReturnAddressStack& GetReturnAddressStack();
+
+    void UpdateTargetPredictor(WordType instructionAddress, WordType target);
+
+    [[nodiscard]] TargetPredictor& GetTargetPredictor();
+
+    /**
+     * Tell the instruction unit that the memory has been written, so that
+     * the stale predecoded instructions are dropped.
+     */
+    void InvalidateDecoded(WordType address, SizeType size);
+
+    [[nodiscard]] float DecodeCacheHitRate() const;
+
+    [[nodiscard]] SizeType EliminatedInstructions() const;
+
+    void PrintFusionStatistics(std::ostream& out) const;
+
 private:
     void Flush();
 
+    Config config_;
+
     long  clock_ = 0;
+    bool  halted_ = false;
+    int   exitCode_ = 0;
 
     class InstructionUnit    instructionUnit_;
     class Memory             memory_;
@@ -68,6 +148,7 @@ private:
     class ReorderBuffer      reorderBuffer_;
     class ReservationStation reservationStation_;
     class LoadStoreBuffer    loadStoreBuffer_;
+    class BranchCheckpoints  branchCheckpoints_;
 };
 
 #endif //RISC_V_SIMULATOR_INCLUDE_BUS_H
@@ -0,0 +1,65 @@
+// RISC-V Simulator
+// Copyright (C) 2022 Lau Yee-Yu
+//
+// This library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#ifndef RISC_V_SIMULATOR_INCLUDE_CONFIG_H
+#define RISC_V_SIMULATOR_INCLUDE_CONFIG_H
+
+#include <map>
+
+#include "predictor.h"
+#include "type.h"
+
+enum class Instruction;
+
+/**
+ * @struct Timing
+ * The cycles an ALU takes for an instruction: the result comes out after the
+ * latency, and the next instruction may start after the interval, which is
+ * 1 if the ALU is fully pipelined.
+ */
+struct Timing {
+    SizeType latency = 1;
+    SizeType interval = 1;
+};
+
+enum class SelectPolicy {
+    index, // the lowest entry of the reservation station first
+    oldest // the oldest instruction first
+};
+
+/**
+ * @struct Config
+ * The microarchitecture parameters chosen at startup.
+ */
+struct Config {
+    SizeType issueWidth = 1;  // instructions issued per cycle
+    SizeType commitWidth = 1; // instructions committed per cycle
+    SizeType fetchWidth = 0;  // instructions fetched per cycle, 0 for the issue width
+    SizeType branchCheckpoints = 8; // unresolved branches in flight, 1 to 32
+    bool     returnAddressStack = true; // predict the returns, or wait for their targets
+    bool     targetPredictor = true; // predict the other indirect jumps, or wait for their targets
+    SizeType physicalRegisters = 64; // registers renamed onto, more than 32
+    SizeType reservationStationSize = 32; // entries of the reservation station, 1 to 256
+    // entries of the queues of the adders, the shifters, the comparers and the
+    // logic units, or all 0 for a reservation station shared by them
+    SizeType reservationQueues[4] = {0, 0, 0, 0};
+    SelectPolicy select = SelectPolicy::index; // the ready entries started first
+    std::map<Instruction, Timing> timings; // the ALU instructions not listed take a cycle
+
+    PredictorConfig predictor;
+};
+
+#endif //RISC_V_SIMULATOR_INCLUDE_CONFIG_H
@@ -0,0 +1,132 @@
+// RISC-V Simulator
+// Copyright (C) 2022 Lau Yee-Yu
+//
+// This library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#ifndef RISC_V_SIMULATOR_INCLUDE_HEX_DECODER_H
+#define RISC_V_SIMULATOR_INCLUDE_HEX_DECODER_H
+
+#include <array>
+
+#include "type.h"
+
+constexpr ByteType kHexSpace   = 0x10;
+constexpr ByteType kHexAt      = 0x20;
+constexpr ByteType kHexInvalid = 0xFF;
+
+/**
+ * The class of each character: 0-15 for hex digits, kHexSpace, kHexAt or
+ * kHexInvalid otherwise.
+ */
+constexpr std::array<ByteType, 256> MakeHexTable() {
+    std::array<ByteType, 256> table{};
+    for (auto& type : table) type = kHexInvalid;
+    for (int i = 0; i < 10; ++i) table['0' + i] = static_cast<ByteType>(i);
+    for (int i = 0; i < 6; ++i) {
+        table['A' + i] = static_cast<ByteType>(10 + i);
+        table['a' + i] = static_cast<ByteType>(10 + i);
+    }
+    table[' '] = table['\t'] = table['\n'] = table['\r'] = kHexSpace;
+    table['\v'] = table['\f'] = kHexSpace;
+    table['@'] = kHexAt;
+    return table;
+}
+
+/**
+ * @class HexDecoder
+ * A streaming decoder for the Verilog hex format, i.e. "@address" records
+ * followed by whitespace-separated hex bytes.  The text can be fed in blocks
+ * of any size; a token split between two blocks is carried over in the
+ * state of the decoder, so no temporary string is ever built.
+ */
+class HexDecoder {
+public:
+    HexDecoder() = default;
+    HexDecoder(const HexDecoder&) = default;
+    HexDecoder(HexDecoder&&) = default;
+
+    HexDecoder& operator=(const HexDecoder&) = default;
+    HexDecoder& operator=(HexDecoder&&) = default;
+
+    ~HexDecoder() = default;
+
+    /**
+     * Decode a block of text.  Every byte decoded is passed to
+     * store(address, value).
+     * @param begin
+     * @param end
+     * @param store a callable taking (WordType, ByteType)
+     * @return false if the text is malformed
+     */
+    template<class Store>
+    bool Decode(const char* begin, const char* end, Store&& store) {
+        const char* p = begin;
+        while (p != end) {
+            // Fast path: a complete "XX " token, which is nearly every token
+            // in an image.
+            if (digits_ == 0 && !inAddress_ && end - p >= 3) {
+                ByteType high = kTable[static_cast<unsigned char>(p[0])];
+                ByteType low  = kTable[static_cast<unsigned char>(p[1])];
+                if ((high | low) < 16 &&
+                    kTable[static_cast<unsigned char>(p[2])] == kHexSpace) {
+                    store(address_++, static_cast<ByteType>(high << 4 | low));
+                    p += 3;
+                    continue;
+                }
+            }
+            ByteType type = kTable[static_cast<unsigned char>(*p)];
+            ++p;
+            if (type < 16) {
+                value_ = value_ << 4 | type;
+                ++digits_;
+                continue;
+            }
+            if (type == kHexInvalid || !EndToken(store)) return false;
+            if (type == kHexAt) inAddress_ = true;
+        }
+        return true;
+    }
+
+    /**
+     * Flush the last token when the input ends without a trailing blank.
+     * @return false if the text ends in the middle of a token
+     */
+    template<class Store>
+    bool Finish(Store&& store) { return EndToken(store); }
+
+private:
+    constexpr static std::array<ByteType, 256> kTable = MakeHexTable();
+
+    template<class Store>
+    bool EndToken(Store& store) {
+        if (inAddress_) {
+            if (digits_ == 0 || digits_ > 8) return false;
+            address_ = value_;
+            inAddress_ = false;
+        } else if (digits_ != 0) {
+            if (digits_ > 2) return false;
+            store(address_++, static_cast<ByteType>(value_));
+        }
+        value_ = 0;
+        digits_ = 0;
+        return true;
+    }
+
+    WordType address_   = 0;
+    WordType value_     = 0;
+    SizeType digits_    = 0;
+    bool     inAddress_ = false;
+};
+
+#endif //RISC_V_SIMULATOR_INCLUDE_HEX_DECODER_H
@@ -0,0 +1,114 @@
+// RISC-V Simulator
+// Copyright (C) 2022 Lau Yee-Yu
+//
+// This library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#ifndef RISC_V_SIMULATOR_INCLUDE_IMAGE_H
+#define RISC_V_SIMULATOR_INCLUDE_IMAGE_H
+
+#include <cstdio>
+#include <vector>
+
+#include "type.h"
+
+/**
+ * @class ProgramImage
+ * A precompiled binary memory image.  The file consists of a header, a
+ * section table and the data of each section:
+ *
+ *   header:  "RVSIMIMG", version, entry, section count, checksum (FNV-1a of
+ *            the section table and the data), reserved
+ *   section: load address, size, file offset, reserved
+ *
+ * The load address, size and file offset of every section are aligned to
+ * kPageSize, so the pages of a section can be used by the guest memory in
+ * place until they are written.  All fields are little endian.
+ *
+ * An ELF32 RISC-V executable can be opened as well, in which case each
+ * PT_LOAD segment becomes a section and the entry point is taken from the
+ * ELF header.  A Verilog hex image is decoded into memory instead.
+ *
+ * An image is immutable once loaded, so one image can be shared by any
+ * number of Memory instances, each of which copies only the pages it
+ * writes.
+ */
+class ProgramImage {
+public:
+    constexpr static SizeType kPageSize = 4096;
+    constexpr static SizeType kVersion = 1;
+
+    struct Section {
+        WordType address;
+        SizeType size;
+        SizeType offset;
+        SizeType fileSize; // the rest of the section is zero-filled
+    };
+
+    ProgramImage() = default;
+    ProgramImage(const ProgramImage&) = delete;
+    ProgramImage(ProgramImage&& other) noexcept;
+
+    ProgramImage& operator=(const ProgramImage&) = delete;
+    ProgramImage& operator=(ProgramImage&& other) noexcept;
+
+    ~ProgramImage();
+
+    /**
+     * Map a binary image file and verify its checksum, or map an ELF32
+     * RISC-V executable.
+     * @param path
+     * @return false if the file cannot be read or is not a valid image
+     */
+    bool Open(const char* path);
+
+    [[nodiscard]] WordType Entry() const;
+
+    [[nodiscard]] const std::vector<Section>& Sections() const;
+
+    /**
+     * Decode a Verilog hex image.  The text is read in large blocks and
+     * decoded straight into page-aligned sections.
+     * @param input the hex text
+     * @return false if the input is malformed
+     */
+    bool ReadHex(std::FILE* input);
+
+    /**
+     * Write the image as a binary image.
+     * @param path
+     * @return false if the file cannot be written
+     */
+    [[nodiscard]] bool Save(const char* path) const;
+
+    /**
+     * Get the data of a section, either in the read-only mapping of the
+     * file or in the decoded hex image.
+     */
+    [[nodiscard]] const ByteType* Data(const Section& section) const;
+
+private:
+    void Close();
+
+    bool ParseBinary();
+
+    bool ParseElf();
+
+    const ByteType*       mapping_ = nullptr;
+    SizeType              mappingSize_ = 0;
+    WordType              entry_ = 0;
+    std::vector<ByteType> storage_; // the data of a hex image
+    std::vector<Section>  sections_;
+};
+
+#endif //RISC_V_SIMULATOR_INCLUDE_IMAGE_H
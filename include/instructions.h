@@ -17,12 +17,20 @@
 #ifndef RISC_V_SIMULATOR_INCLUDE_INSTRUCTIONS_H
 #define RISC_V_SIMULATOR_INCLUDE_INSTRUCTIONS_H
 
+#include <memory>
+#include <ostream>
+
+#include "circular_queue.h"
+#include "config.h"
 #include "memory.h"
 #include "predictor.h"
 #include "register.h"
+#include "return_address_stack.h"
+#include "target_predictor.h"
 #include "type.h"
 
 class Bus;
+struct BranchCheckpoint;
 
 enum class Instruction {
     LUI, // Load Upper Immediate
@@ -62,9 +70,18 @@ enum class Instruction {
     SRA, // Shift Right Arithmetic
     OR, // OR
     AND, // AND
-    END // End of Main 0x0ff00513
+    END, // End of Main 0x0ff00513
+    ILLEGAL // Illegal Instruction
 };
 
+constexpr SizeType kInstructionCount = static_cast<SizeType>(Instruction::ILLEGAL) + 1;
+
+inline bool IsBranch(Instruction instruction) {
+    return instruction == Instruction::BEQ || instruction == Instruction::BNE ||
+           instruction == Instruction::BLT || instruction == Instruction::BGE ||
+           instruction == Instruction::BLTU || instruction == Instruction::BGEU;
+}
+
 struct InstructionInfo {
     Instruction instruction;
     SizeType register1;
@@ -75,24 +92,25 @@ struct InstructionInfo {
 
 class InstructionUnit {
 public:
-    InstructionUnit();
-    InstructionUnit(const InstructionUnit&) = default;
+    explicit InstructionUnit(const Config& config);
+    InstructionUnit(const InstructionUnit&) = delete;
     InstructionUnit(InstructionUnit&&) = default;
 
-    InstructionUnit& operator=(const InstructionUnit&) = default;
+    InstructionUnit& operator=(const InstructionUnit&) = delete;
     InstructionUnit& operator=(InstructionUnit&&) = default;
 
     ~InstructionUnit() = default;
 
     /**
-     * Decode the instruction.
+     * Fetch up to fetchWidth instructions into the fetch queue, and issue up
+     * to issueWidth instructions from the queue.  The issue stops at a full
+     * RoB, RS or LSB, while the fetch goes on until the queue is full.
      * @param bus
-     * @return the instruction info
      */
     void FetchAndPush(Bus& bus);
 
     /**
-     * Set the PC.  Please note that is function is called only when the
+     * Set the fetch PC.  Please note that is function is called only when the
      * prediction is incorrect.
      * @param pc
      */
@@ -100,16 +118,158 @@ public:
 
     void ResetStateOnClearPipeline();
 
+    /**
+     * Drop the instructions fetched after a mispredicted branch, restore the
+     * predictors to the checkpoint of the branch, and fetch from pc.
+     * @param checkpoint
+     * @param address the address of the branch
+     * @param answer whether the branch is taken
+     * @param pc
+     */
+    void Recover(const BranchCheckpoint& checkpoint, WordType address, bool answer, WordType pc);
+
     Predictor& GetPredictor();
 
+    ReturnAddressStack& GetReturnAddressStack();
+
+    TargetPredictor& GetTargetPredictor();
+
     [[nodiscard]] float PredictorAccuracy() const;
 
+    /**
+     * Invalidate the predecoded instructions overlapped by a store.
+     * @param address
+     * @param size
+     */
+    void InvalidateDecoded(WordType address, SizeType size);
+
+    [[nodiscard]] float DecodeCacheHitRate() const;
+
+    /**
+     * Get the number of instructions completed at rename.
+     */
+    [[nodiscard]] SizeType Eliminated() const;
+
+    /**
+     * Print the number of the fused pairs of each kind, and the ratio of the
+     * instructions issued in fused pairs.
+     * @param out
+     */
+    void PrintFusionStatistics(std::ostream& out) const;
+
 private:
-    bool           stall_ = false;
-    SignedWordType immediate_ = 0; // for JALR
-    SizeType       dependency_ = 0; // for JALR
-    Register       PC_;
-    Predictor      predictor_;
+    constexpr static SizeType kDecodeCacheSize = 4096;
+    constexpr static SizeType kFetchQueueSize = 16;
+
+    /**
+     * The pairs of adjacent instructions fused at fetch.  The fused pair is
+     * issued as the single instruction doing the same:
+     * - lui rd, hi; addi rd, rd, lo: lui rd, hi + lo
+     * - auipc rd, hi; jalr rd, lo(rd): jal rd at the JALR to the target
+     * - lui rd, hi; load rd, lo(rd): load rd, hi + lo(x0)
+     * - slli rd, rs, n; srli rd, rd, n: andi rd, rs, 0xFFFFFFFF >> n
+     */
+    enum class Fusion {
+        none,
+        luiAddi,
+        auipcJalr,
+        luiLoad,
+        shifts
+    };
+
+    /**
+     * @struct FetchEntry
+     * An instruction fetched ahead of issue, with the prediction made at
+     * fetch.
+     */
+    struct FetchEntry {
+        InstructionInfo info;
+        WordType        address = 0;
+        bool            predicted = false; // branch: taken; JALR: has a target
+        WordType        predictedTarget = 0; // for JALR
+        ReturnAddressStack::Checkpoint stack; // the stack after it
+        WordType        history = 0; // the path history before it
+        HistoryType     branchHistory = 0; // JALR: the branch history after it; branch: before it
+        Fusion          fusion = Fusion::none; // the address is that of the second one if fused
+    };
+
+    struct DecodeCacheEntry {
+        bool            valid = false;
+        WordType        address = 0;
+        InstructionInfo info;
+    };
+
+    /**
+     * Get the decoded instruction at an address, from the decode cache if
+     * possible.
+     */
+    const InstructionInfo& Decode(const Memory& memory, WordType address);
+
+    /**
+     * Fuse a fetched instruction with the next one if they make a pair.
+     * @param memory
+     * @param fetched the first instruction, replaced by the fused one
+     * @return whether the instructions have been fused
+     */
+    bool Fuse(const Memory& memory, FetchEntry& fetched);
+
+    /**
+     * Fetch along the predicted path until a taken branch or jump.
+     * @param memory
+     */
+    void Fetch(const Memory& memory);
+
+    /**
+     * Issue a fetched instruction.
+     * @param fetched
+     * @param bus
+     * @return whether the next instruction in the fetch queue can be issued
+     *         in the same cycle
+     */
+    bool Issue(const FetchEntry& fetched, Bus& bus);
+
+    /**
+     * Complete an instruction at rename if it is a move (addi rd, rs, 0), a
+     * constant (addi rd, x0, imm) or an arithmetic instruction writing x0,
+     * so that it does not take a reservation station entry.
+     * @param info
+     * @param bus
+     * @return whether the instruction has been completed
+     */
+    bool Eliminate(const InstructionInfo& info, Bus& bus);
+
+    /**
+     * Drop the instructions fetched after a JALR whose target is found at
+     * issue, and fetch from the target.
+     * @param jump
+     * @param target
+     */
+    void Redirect(const FetchEntry& jump, WordType target);
+
+    SizeType issueWidth_;
+    SizeType fetchWidth_;
+    bool     predictReturns_;
+    bool     predictJumps_;
+
+    CircularQueue<FetchEntry, kFetchQueueSize> fetchQueue_;
+    bool                                       fetchStopped_ = false;
+
+    DecodeCacheEntry decodeCache_[kDecodeCacheSize];
+    SizeType         decodeHit_ = 0;
+    SizeType         decodeMiss_ = 0;
+
+    SizeType eliminated_ = 0;
+    SizeType issued_ = 0;
+    SizeType fused_[5] = {0}; // for each kind of fusion
+
+    bool               stall_ = false;
+    SignedWordType     immediate_ = 0; // for JALR
+    SizeType           dependency_ = 0; // for JALR: the physical base register
+    FetchEntry         stalledJump_; // for JALR
+    Register           PC_;
+    std::unique_ptr<Predictor> predictor_;
+    ReturnAddressStack returnAddressStack_;
+    TargetPredictor    targetPredictor_;
 };
 
 #endif //RISC_V_SIMULATOR_INCLUDE_INSTRUCTIONS_H
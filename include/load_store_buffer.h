@@ -17,10 +17,16 @@
 #ifndef RISC_V_SIMULATOR_INCLUDE_LOAD_STORE_BUFFER_H
 #define RISC_V_SIMULATOR_INCLUDE_LOAD_STORE_BUFFER_H
 
-#include "instructions.h"
+#include <vector>
+
+#include "bit_mask.h"
+#include "branch_checkpoints.h"
 #include "circular_queue.h"
+#include "config.h"
+#include "instructions.h"
 
 class Bus;
+class RegisterFile;
 class ReorderBuffer;
 
 struct LoadStoreEntry {
@@ -29,16 +35,26 @@ struct LoadStoreEntry {
     bool valueConstraint = false;
     Instruction    type;
     WordType       base;
-    WordType       baseConstraintIndex;
+    SizeType       baseConstraintIndex; // the physical register waited for
     SignedSizeType offset;
     WordType       value;
-    WordType       valueConstraintIndex;
+    SizeType       valueConstraintIndex;
     SizeType       RoBIndex;
+    SizeType       destination = 0; // for load: the physical register written
+    BranchMask     branchMask = 0; // the unresolved branches older than it
 };
 
+/**
+ * @class LoadStoreBuffer
+ * The loads and stores are kept in program order, and executed one by one at
+ * the head.  A waiting entry is listed under the physical registers it waits
+ * for, and is only woken up when one of them is broadcast.
+ */
 class LoadStoreBuffer {
 public:
-    LoadStoreBuffer() = default;
+    constexpr static SizeType kSize = 32;
+
+    explicit LoadStoreBuffer(const Config& config);
     LoadStoreBuffer(const LoadStoreBuffer&) = default;
     LoadStoreBuffer(LoadStoreBuffer&&) = default;
 
@@ -57,14 +73,43 @@ public:
 
     void ClearOnWrongPrediction();
 
+    /**
+     * Drop the entries younger than a mispredicted branch.
+     * @param branch the tag of the branch
+     */
+    void Squash(BranchMask branch);
+
+    /**
+     * Remove the resolved branches from the branch masks.
+     * @param branches
+     */
+    void ResolveBranches(BranchMask branches);
+
     [[nodiscard]] SizeType GetEndIndex() const;
 
 private:
-    void UpdateBusyState(ReorderBuffer& reorderBuffer);
+    using EntryMask = BitMask<kSize>;
+
+    /**
+     * Wake up the entries waiting for the physical registers broadcast, and
+     * mark the settled ones ready.
+     * @param reorderBuffer
+     * @param registerFile
+     */
+    void UpdateBusyState(ReorderBuffer& reorderBuffer, const RegisterFile& registerFile);
+
+    /**
+     * Tell whether an index is within the queue.
+     * @param index
+     */
+    [[nodiscard]] bool InUse(SizeType index) const;
 
     void MemoryIO(Bus& bus);
 
-    CircularQueue<LoadStoreEntry, 32> buffer_;
+    CircularQueue<LoadStoreEntry, kSize> buffer_;
+
+    std::vector<EntryMask> consumers_; // the entries waiting for each physical register
+    EntryMask              settled_; // the entries whose operands have all arrived
 
     mutable SizeType count_ = 0; // 2 - 0
 };
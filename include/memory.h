@@ -17,11 +17,35 @@
 #ifndef RISC_V_SIMULATOR_INCLUDE_MEMORY_H
 #define RISC_V_SIMULATOR_INCLUDE_MEMORY_H
 
+#include <memory>
+
 #include "type.h"
 
+class ProgramImage;
+
+/**
+ * @class Memory
+ * A sparse memory covering the whole 32-bit address space.  The pages are
+ * kept in a two-level page table and allocated zero-filled when they are
+ * first written; reading a page that has never been written gives zero.
+ * The last page read and the last page written are cached, so that most
+ * accesses cost a comparison only.
+ *
+ * The pages of the program image are shared with every other memory loaded
+ * from the same image, and a private copy is made on the first write.
+ */
 class Memory {
 public:
-    explicit Memory(SizeType size);
+    constexpr static SizeType kPageBits = 12;
+    constexpr static SizeType kPageSize = 1 << kPageBits;
+
+    Memory() = default;
+    Memory(const Memory&) = delete;
+    Memory(Memory&&) = delete;
+
+    Memory& operator=(const Memory&) = delete;
+    Memory& operator=(Memory&&) = delete;
+
     ~Memory();
 
     [[nodiscard]] WordType ReadWord(SizeType index) const;
@@ -37,12 +61,49 @@ public:
     void StoreByte(SizeType index, ByteType value);
 
     /**
-     * Init from stdin.
+     * Load a program image.  The page-aligned pages of the image are used in
+     * place and copied only when they are written.  The others are copied.
+     * @param image
      */
-    void Init();
+    void Load(std::shared_ptr<const ProgramImage> image);
+
+    /**
+     * Get the number of pages owned by the memory.
+     */
+    [[nodiscard]] SizeType PageCount() const;
 
 private:
-    ByteType* memory_;
+    constexpr static SizeType kTableBits = 10;
+    constexpr static SizeType kTableSize = 1 << kTableBits;
+
+    struct PageTable {
+        ByteType* pages[kTableSize] = {nullptr};
+        bool      owned[kTableSize] = {false};
+    };
+
+    template<class T>
+    [[nodiscard]] T Read(SizeType index) const;
+
+    template<class T>
+    void Store(SizeType index, T value);
+
+    [[nodiscard]] const ByteType* ReadablePage(WordType page) const;
+
+    ByteType* WritablePage(WordType page);
+
+    void Copy(WordType address, const ByteType* data, SizeType size);
+
+    void Zero(WordType address, SizeType size);
+
+    PageTable* directory_[kTableSize] = {nullptr};
+    SizeType   pageCount_ = 0;
+
+    std::shared_ptr<const ProgramImage> image_;
+
+    mutable WordType        readPage_ = ~WordType(0);
+    mutable const ByteType* readData_ = nullptr;
+    WordType                writePage_ = ~WordType(0);
+    ByteType*               writeData_ = nullptr;
 };
 
 #endif //RISC_V_SIMULATOR_INCLUDE_MEMORY_H
@@ -14,44 +14,325 @@
 // You should have received a copy of the GNU General Public License
 // along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
+
 #ifndef RISC_V_SIMULATOR_INCLUDE_PREDICTOR_H
 #define RISC_V_SIMULATOR_INCLUDE_PREDICTOR_H
 
+#include <map>
+#include <memory>
+#include <ostream>
+
 #include "type.h"
 
+using HistoryType = uint64_t;
+
+enum class PredictorType {
+    local, // 4-bit two-level local adaptive predictor
+    bimodal, // 2-bit saturating counters indexed by the address
+    gshare, // 2-bit saturating counters indexed by the address and the global history
+    tournament, // local and gshare, chosen by 2-bit saturating counters
+    tage, // tagged geometric history length
+    perceptron // perceptrons over the global history, chosen by the hashed address
+};
+
+struct PredictorConfig {
+    PredictorType type = PredictorType::local;
+    SizeType perceptronHistory = 32; // 1 to 64 branches
+    SizeType perceptronWeightBits = 8; // 2 to 16 bits
+    bool branchStatistics = false; // count the predictions of each branch
+};
+
 /**
  * @class Predictor
- * A 4-bit two-level adaptive predictor
+ * The interface of the branch predictors.  The predictions are made at fetch,
+ * and the predictors are updated with the real answer at commit.  A predictor
+ * with a global history keeps a speculative copy of it, which is updated with
+ * each prediction and restored when the pipeline is cleared.
  */
 class Predictor {
 public:
-    constexpr static SizeType kBitCount = 4; // the number of bit that the predictor uses
-    constexpr static SizeType kBucketSize = 4096; // the number of buckets to hold the data
-    constexpr static WordType kAnd = 0b1111'1111'1111;
-    struct PatternHistoryTable {
-        bool prediction[1 << kBitCount] = {false};
-    };
-
-    Predictor();
+    Predictor() = default;
     Predictor(const Predictor&) = default;
     Predictor(Predictor&&) = default;
 
     Predictor& operator=(const Predictor&) = default;
     Predictor& operator=(Predictor&&) = default;
 
-    ~Predictor() = default;
+    virtual ~Predictor() = default;
 
-    [[nodiscard]] bool Predict(WordType instructionAddress);
+    /**
+     * Create the predictor of the given type.
+     * @param config
+     * @return the predictor
+     */
+    static std::unique_ptr<Predictor> Create(const PredictorConfig& config);
 
-    void Update(WordType instructionAddress, bool answer);
+    [[nodiscard]] virtual bool Predict(WordType instructionAddress) const = 0;
+
+    /**
+     * Add a prediction to the speculative history.
+     * @param instructionAddress
+     * @param prediction
+     */
+    virtual void Speculate(WordType /*instructionAddress*/, bool /*prediction*/) {}
+
+    /**
+     * Get the speculative history, to restore it when the instructions
+     * fetched after this point are dropped.
+     */
+    [[nodiscard]] virtual HistoryType Save() const { return 0; }
+
+    virtual void Restore(HistoryType /*history*/) {}
+
+    /**
+     * Restore the speculative history from the committed branches.
+     */
+    virtual void Restore() {}
+
+    /**
+     * Count whether the prediction is correct, and learn the answer.
+     * @param instructionAddress
+     * @param answer
+     * @param prediction the prediction made at fetch
+     */
+    void Update(WordType instructionAddress, bool answer, bool prediction);
 
     [[nodiscard]] float GetAccuracy() const;
 
+    /**
+     * Print the accuracy of each branch, if the branch statistics are
+     * enabled.
+     * @param out
+     */
+    void PrintBranchStatistics(std::ostream& out) const;
+
+protected:
+    virtual void Train(WordType instructionAddress, bool answer) = 0;
+
 private:
-    PatternHistoryTable patternHistoryTable_[kBucketSize];
-    ByteType history_[kBucketSize] = {0};
+    struct BranchRecord {
+        SizeType correct = 0;
+        SizeType wrong = 0;
+    };
+
     SizeType totalWrong_ = 0;
     SizeType totalCorrect_ = 0;
+    bool     recordBranches_ = false;
+    std::map<WordType, BranchRecord> branches_;
+};
+
+/**
+ * @class LocalPredictor
+ * A 4-bit two-level adaptive predictor
+ */
+class LocalPredictor : public Predictor {
+public:
+    constexpr static SizeType kBitCount = 4; // the number of bit that the predictor uses
+    constexpr static SizeType kBucketSize = 4096; // the number of buckets to hold the data
+    constexpr static WordType kAnd = 0b1111'1111'1111;
+    struct PatternHistoryTable {
+        bool prediction[1 << kBitCount] = {false};
+    };
+
+    [[nodiscard]] bool Predict(WordType instructionAddress) const override;
+
+    void Train(WordType instructionAddress, bool answer) override;
+
+private:
+    PatternHistoryTable patternHistoryTable_[kBucketSize];
+    ByteType history_[kBucketSize] = {0};
+};
+
+/**
+ * @class BimodalPredictor
+ * A table of 2-bit saturating counters indexed by the instruction address
+ */
+class BimodalPredictor : public Predictor {
+public:
+    constexpr static SizeType kCounterCount = 4096;
+
+    [[nodiscard]] bool Predict(WordType instructionAddress) const override;
+
+    void Train(WordType instructionAddress, bool answer) override;
+
+private:
+    ByteType counters_[kCounterCount] = {0};
+};
+
+/**
+ * @class GsharePredictor
+ * A table of 2-bit saturating counters indexed by the instruction address
+ * XOR the outcomes of the recent branches
+ */
+class GsharePredictor : public Predictor {
+public:
+    constexpr static SizeType kHistoryBits = 12;
+    constexpr static SizeType kCounterCount = 1 << kHistoryBits;
+
+    [[nodiscard]] bool Predict(WordType instructionAddress) const override;
+
+    /**
+     * Predict with the history of the committed branches, which is the
+     * history the oldest branch in flight was predicted with.
+     */
+    [[nodiscard]] bool PredictAtCommit(WordType instructionAddress) const;
+
+    void Speculate(WordType instructionAddress, bool prediction) override;
+
+    [[nodiscard]] HistoryType Save() const override;
+
+    void Restore(HistoryType history) override;
+
+    void Restore() override;
+
+    void Train(WordType instructionAddress, bool answer) override;
+
+private:
+    [[nodiscard]] static SizeType Index(WordType instructionAddress, WordType history);
+
+    [[nodiscard]] static WordType NextHistory(WordType history, bool answer);
+
+    ByteType counters_[kCounterCount] = {0};
+    WordType history_ = 0;
+    WordType speculativeHistory_ = 0;
+};
+
+/**
+ * @class TournamentPredictor
+ * A local and a gshare predictor, with a table of 2-bit saturating counters
+ * indexed by the instruction address choosing which one to follow.  The
+ * choice moves towards the predictor that was right when they disagree.
+ */
+class TournamentPredictor : public Predictor {
+public:
+    constexpr static SizeType kChooserCount = 4096;
+
+    [[nodiscard]] bool Predict(WordType instructionAddress) const override;
+
+    void Speculate(WordType instructionAddress, bool prediction) override;
+
+    [[nodiscard]] HistoryType Save() const override;
+
+    void Restore(HistoryType history) override;
+
+    void Restore() override;
+
+    void Train(WordType instructionAddress, bool answer) override;
+
+private:
+    LocalPredictor  local_;
+    GsharePredictor global_;
+    ByteType        chooser_[kChooserCount] = {0}; // 2 and 3 for gshare
+};
+
+/**
+ * @class TagePredictor
+ * A TAGE predictor: a bimodal base predictor and tagged tables indexed by
+ * the instruction address and global histories of geometric lengths.  The
+ * table with the longest matching history provides the prediction.  On a
+ * misprediction an entry is allocated in a table with a longer history,
+ * replacing an entry whose useful counter is 0.  The useful counters are
+ * aged periodically.  The global history is updated speculatively at fetch
+ * and restored when the pipeline is cleared.
+ */
+class TagePredictor : public Predictor {
+public:
+    constexpr static SizeType kTableCount = 4;
+    constexpr static SizeType kHistoryLengths[kTableCount] = {5, 11, 22, 44};
+    constexpr static SizeType kIndexBits = 10;
+    constexpr static SizeType kTagBits = 9;
+    constexpr static SizeType kBaseCount = 4096;
+    constexpr static SizeType kAgingPeriod = 1 << 18; // updates between aging the useful counters
+
+    struct Entry {
+        ByteType     counter = 4; // 3-bit counter, taken if at least 4
+        ByteType     useful = 0; // 2-bit counter
+        HalfWordType tag = 0;
+        bool         valid = false; // allocated, so that the initial tag matches nothing
+    };
+
+    [[nodiscard]] bool Predict(WordType instructionAddress) const override;
+
+    void Speculate(WordType instructionAddress, bool prediction) override;
+
+    [[nodiscard]] HistoryType Save() const override;
+
+    void Restore(HistoryType history) override;
+
+    void Restore() override;
+
+    void Train(WordType instructionAddress, bool answer) override;
+
+private:
+    /**
+     * @struct Lookup
+     * The matching entries of a branch under a history.
+     */
+    struct Lookup {
+        SizeType index[kTableCount];
+        SizeType tag[kTableCount];
+        int      provider = -1; // the table with the longest match, -1 for the base
+        int      alternative = -1; // the table with the next longest match
+        bool     prediction = false;
+        bool     alternativePrediction = false;
+    };
+
+    [[nodiscard]] Lookup Find(WordType instructionAddress, HistoryType history) const;
+
+    ByteType    base_[kBaseCount] = {0}; // 2-bit counters
+    Entry       tables_[kTableCount][1 << kIndexBits];
+    HistoryType history_ = 0;
+    HistoryType speculativeHistory_ = 0;
+    SizeType    updateCount_ = 0;
+    SizeType    allocationSeed_ = 0;
+};
+
+/**
+ * @class PerceptronPredictor
+ * A perceptron predictor.  The hashed instruction address chooses a
+ * perceptron, whose output is its bias weight plus its other weights, each
+ * negated if the corresponding branch in the global history is not taken.
+ * The branch is predicted taken if the output is not negative.  The weights
+ * are trained when the prediction is wrong or the output is not beyond the
+ * threshold.  The global history is updated speculatively at fetch and
+ * restored when the pipeline is cleared.
+ */
+class PerceptronPredictor : public Predictor {
+public:
+    constexpr static SizeType kPerceptronCount = 1024;
+    constexpr static SizeType kMaxHistory = 64;
+
+    /**
+     * @param historyLength the number of branches in the history, 1 to 64
+     * @param weightBits the width of the signed weights, 2 to 16
+     */
+    PerceptronPredictor(SizeType historyLength, SizeType weightBits);
+
+    [[nodiscard]] bool Predict(WordType instructionAddress) const override;
+
+    void Speculate(WordType instructionAddress, bool prediction) override;
+
+    [[nodiscard]] HistoryType Save() const override;
+
+    void Restore(HistoryType history) override;
+
+    void Restore() override;
+
+    void Train(WordType instructionAddress, bool answer) override;
+
+private:
+    [[nodiscard]] int Output(WordType instructionAddress, HistoryType history) const;
+
+    [[nodiscard]] int16_t* Weights(WordType instructionAddress);
+
+    [[nodiscard]] const int16_t* Weights(WordType instructionAddress) const;
+
+    SizeType             historyLength_;
+    int                  maxWeight_;
+    int                  threshold_;
+    std::unique_ptr<int16_t[]> weights_; // (historyLength + 1) weights per perceptron
+    HistoryType          history_ = 0;
+    HistoryType          speculativeHistory_ = 0;
 };
 
 #endif //RISC_V_SIMULATOR_INCLUDE_PREDICTOR_H
@@ -19,6 +19,7 @@
 
 #include <cstddef>
 #include <cstdint>
+#include <vector>
 
 #include "type.h"
 
@@ -39,25 +40,56 @@ public:
 
     Register& operator+=(SignedWordType rhs);
 
-    [[nodiscard]] bool Dirty() const;
-
-    [[nodiscard]] SizeType Dependency() const;
-
-    void SetDependency(SizeType index);
-
-    void TryResetWithIndex(SizeType index);
-
-    void ResetDependency();
-
 private:
-    WordType value_      = 0;
-    bool     dirty_      = false;
-    WordType dependency_ = 0;
+    WordType value_ = 0;
+};
+
+struct PhysicalRegister {
+    bool     ready = true;
+    WordType value = 0;
 };
 
+/**
+ * @class RegisterFile
+ * The physical registers, and the map tables renaming the architectural
+ * registers onto them.  An instruction writing a register takes a free
+ * physical register at issue, and the physical register it replaces in the
+ * map is freed when it commits.  The free list is a circular queue, so that
+ * the registers taken after a checkpoint are given back by moving its head.
+ * x0 is always mapped to the physical register 0, which holds 0.
+ *
+ * A register move is eliminated by mapping the destination to the physical
+ * register of the source.  A physical register counts the mappings to it,
+ * and is freed when the last one is replaced.  The moves in flight are kept
+ * in a log, so that the counts can be taken back on a misprediction.
+ *
+ * The map tables are not double buffered: the instructions issued in a cycle
+ * see the registers renamed by the earlier ones in the same cycle, and the
+ * commit comes after the issue in each cycle.  The physical registers are
+ * double buffered like the RoB.  Only the registers renamed or written in a
+ * cycle are copied into the current state, and the ones written are broadcast
+ * in the next cycle, when their values can be seen, so that the waiting
+ * instructions do not look at the registers every cycle.
+ */
 class RegisterFile {
 public:
-    RegisterFile() = default;
+    constexpr static SizeType kRegisterCount = 32;
+
+    /**
+     * @struct Checkpoint
+     * The map table, the head of the free list and the end of the move log,
+     * saved when a branch is issued.
+     */
+    struct Checkpoint {
+        SizeType map[kRegisterCount] = {0};
+        SizeType freeHead = 0;
+        SizeType moveTail = 0;
+    };
+
+    /**
+     * @param physicalCount the number of physical registers, more than 32
+     */
+    explicit RegisterFile(SizeType physicalCount);
     RegisterFile(const RegisterFile&) = default;
     RegisterFile(RegisterFile&&) = default;
     RegisterFile& operator=(const RegisterFile&) = default;
@@ -65,29 +97,117 @@ public:
     ~RegisterFile() = default;
 
     /**
-     * Get the register by index.
-     * @param index
-     * @return the register value
+     * Get the physical register in the next state.
      */
-    [[nodiscard]] WordType Read(SizeType index);
+    const PhysicalRegister& operator[](SizeType physical);
 
-    void Write(SizeType index, WordType value, SizeType dependency);
+    /**
+     * Get the physical register in the current state.
+     */
+    const PhysicalRegister& operator[](SizeType physical) const;
 
-    void AboutToWrite(SizeType index, SizeType dependency);
+    /**
+     * Write the result of an instruction into a physical register in the
+     * next state, and mark it ready.  The writes to the physical register 0
+     * are dropped.
+     * @param physical
+     * @param value
+     */
+    void Write(SizeType physical, WordType value);
 
-    void ResetDependency();
+    /**
+     * Get the physical register an architectural register is mapped to.
+     * @param index the architectural register
+     */
+    [[nodiscard]] SizeType Map(SizeType index) const;
 
-    void Flush();
+    /**
+     * Get the physical registers written in the last cycle, whose values are
+     * in the current state.
+     */
+    [[nodiscard]] const std::vector<SizeType>& Broadcast() const;
+
+    /**
+     * Tell whether there is no free physical register.
+     */
+    [[nodiscard]] bool Full() const;
 
-    [[nodiscard]] bool Dirty(SizeType index) const;
+    /**
+     * Map an architectural register to a free physical register, which is
+     * not ready until it is written.  Please check whether there is a free
+     * physical register before calling this function.  x0 is not renamed.
+     * @param index the architectural register
+     * @param previous the physical register it was mapped to
+     * @return the physical register, or 0 for x0
+     */
+    SizeType Rename(SizeType index, SizeType& previous);
 
-    [[nodiscard]] SizeType Dependency(SizeType index) const;
+    /**
+     * Map an architectural register to the physical register of another one,
+     * without taking a free physical register.
+     * @param index the architectural register, not x0
+     * @param source the architectural register moved from
+     * @param previous the physical register it was mapped to
+     * @return the physical register
+     */
+    SizeType Move(SizeType index, SizeType source, SizeType& previous);
 
-private:
-    constexpr static SizeType kRegisterCount = 32;
+    /**
+     * Commit a write to an architectural register, and free the physical
+     * register it replaced if nothing else is mapped to it.
+     * @param index
+     * @param physical
+     * @param previous
+     * @param moved whether it was renamed by Move
+     */
+    void Commit(SizeType index, SizeType physical, SizeType previous, bool moved);
+
+    /**
+     * Get the committed value of an architectural register.
+     * @param index
+     */
+    [[nodiscard]] WordType Read(SizeType index) const;
+
+    /**
+     * Drop the registers renamed after the last commit.
+     */
+    void Reset();
 
-    Register registers_[kRegisterCount];
-    Register nextRegisters_[kRegisterCount];
+    [[nodiscard]] Checkpoint Save() const;
+
+    /**
+     * Drop the registers renamed after a checkpoint.
+     * @param checkpoint
+     */
+    void Restore(const Checkpoint& checkpoint);
+
+    void Flush();
+
+private:
+    /**
+     * Drop a mapping to a physical register, and free it if it is the last.
+     */
+    void Release(SizeType physical);
+
+    SizeType map_[kRegisterCount];
+    SizeType committedMap_[kRegisterCount];
+
+    std::vector<SizeType> freeList_; // a circular queue of all the physical registers
+    SizeType              freeHead_ = 0;
+    SizeType              freeCount_;
+    SizeType              committedHead_ = 0; // the free list head without the uncommitted renames
+    std::vector<SizeType> mappings_; // the number of mappings to each physical register
+
+    // the sources of the uncommitted moves, which are fewer than the RoB entries
+    std::vector<SizeType> moves_;
+    SizeType              moveHead_ = 0;
+    SizeType              moveCount_ = 0;
+
+    std::vector<PhysicalRegister> registers_;
+    std::vector<PhysicalRegister> nextRegisters_;
+    std::vector<SizeType>         changed_; // the registers renamed or written in this cycle
+    std::vector<SizeType>         written_; // the registers written in this cycle
+    std::vector<SizeType>         broadcast_; // the registers written in the last cycle
 };
 
 #endif //RISC_V_SIMULATOR_INCLUDE_REGISTER_H
@@ -18,7 +18,9 @@
 #define RISC_V_SIMULATOR_INCLUDE_REORDER_BUFFER_H
 
 #include "circular_queue.h"
+#include "config.h"
 #include "register.h"
+#include "return_address_stack.h"
 #include "type.h"
 
 class Bus;
@@ -27,16 +29,26 @@ enum class ReorderType {
     registerWrite,
     memoryWrite,
     branch,
-    end
+    jump, // JALR, which also writes the register
+    end,
+    illegal
 };
 
 struct ReorderBufferEntry {
     bool ready = false;
-    bool predictedAnswer = false;
+    bool predictedAnswer = false; // for jump: whether the target was predicted
     ReorderType type;
+    StackOperation stackOperation = StackOperation::none;
     SizeType index;
     WordType value;
+    SizeType physical = 0; // for register writes: the physical register renamed to
+    SizeType previous = 0; // for register writes: the physical register freed at commit
+    bool     moved = false; // for register writes: a move eliminated at issue
     WordType address;
+    SizeType baseRegister = 0; // for jump
+    WordType offset = 0; // for jump
+    WordType predictedTarget = 0; // for jump
+    SizeType checkpoint = 0; // for branch: the tag of its checkpoint
 };
 
 /**
@@ -46,7 +58,7 @@ struct ReorderBufferEntry {
  */
 class ReorderBuffer {
 public:
-    ReorderBuffer() = default;
+    explicit ReorderBuffer(const Config& config);
     ReorderBuffer(const ReorderBuffer&) = default;
     ReorderBuffer(ReorderBuffer&&) = default;
 
@@ -55,6 +67,12 @@ public:
 
     ~ReorderBuffer() = default;
 
+    /**
+     * Retire up to the commit width of ready entries from the head.  The
+     * commit stops after a memory write, a mispredicted jump or the end of
+     * the program.
+     * @param bus
+     */
     void TryCommit(Bus& bus);
 
     ReorderBufferEntry& operator[](SizeType index);
@@ -67,13 +85,31 @@ public:
 
     void Flush();
 
+    /**
+     * Tell whether the RoB is full, counting the entries added in this cycle.
+     */
     [[nodiscard]] bool Full() const;
 
-    SizeType Add(const ReorderBufferEntry& entry, Bus& bus);
+    SizeType Add(const ReorderBufferEntry& entry);
+
+    /**
+     * Drop the entries younger than the entry at index.
+     * @param index
+     */
+    void SquashAfter(SizeType index);
 
     void Clear();
 
 private:
+    /**
+     * Retire one entry.
+     * @param entry the entry at the head
+     * @param bus
+     * @return whether the next entry can be retired in the same cycle.
+     */
+    bool Commit(const ReorderBufferEntry& entry, Bus& bus);
+
+    SizeType commitWidth_ = 1;
     CircularQueue<ReorderBufferEntry, 32> buffer_;
     CircularQueue<ReorderBufferEntry, 32> nextBuffer_;
 };
@@ -17,29 +17,54 @@
 #ifndef RISC_V_SIMULATOR_INCLUDE_RESERVATION_STATION_H
 #define RISC_V_SIMULATOR_INCLUDE_RESERVATION_STATION_H
 
+#include <ostream>
+#include <vector>
+
 #include "ALU.h"
+#include "bit_mask.h"
+#include "branch_checkpoints.h"
+#include "config.h"
 #include "instructions.h"
 
+class Bus;
 class RegisterFile;
 class ReorderBuffer;
 
 struct RSEntry {
-    bool        busy = false;
-    bool        empty = true;
+    bool        busy = false; // waiting for an operand when it is added
     bool        Q1Constraint = false;
     bool        Q2Constraint = false;
-    bool        executing = false;
     Instruction instruction;
     WordType    Value1;
     WordType    Value2;
-    WordType    Q1;
-    WordType    Q2;
+    SizeType    Q1; // the physical register waited for
+    SizeType    Q2;
     SizeType    RoBIndex;
+    SizeType    destination = 0; // the physical register written
+    BranchMask  branchMask = 0; // the unresolved branches older than it
 };
 
+/**
+ * @class ReservationStation
+ * The entries are kept in place, and their states are kept in bit masks: the
+ * entries in use, those waiting for an operand and those being executed.
+ * The masks are double buffered, while an entry is only written when it is
+ * added, woken up or resolved, which the current state does not see.  The
+ * ready entries of each kind of ALU are selected from the lowest index by
+ * counting the trailing zeros, or from the oldest one by an age matrix, where
+ * each entry keeps a mask of the entries added before it.  A waiting entry
+ * is listed under the physical registers it waits for, and is only woken up
+ * when one of them is broadcast.
+ *
+ * The entries may be split into a queue for each kind of ALU, so that the
+ * instructions of one kind cannot fill the entries the others need.  A queue
+ * is a range of the entries, which its kind of instructions take from.
+ */
 class ReservationStation {
 public:
-    ReservationStation() = default;
+    constexpr static SizeType kMaxEntries = 256;
+
+    explicit ReservationStation(const Config& config);
     ReservationStation(const ReservationStation&) = default;
     ReservationStation(ReservationStation&&) = default;
 
@@ -50,23 +75,127 @@ public:
 
     void Flush();
 
-    void Execute(ReorderBuffer& reorderBuffer);
+    /**
+     * Write back the results, start the ready entries and wake up the
+     * waiting ones.  A mispredicted branch is recovered from at once.
+     * @param bus
+     */
+    void Execute(Bus& bus);
+
+    /**
+     * Tell whether there is no free entry for an instruction, counting the
+     * entries added in this cycle.  The instructions not executed by the ALUs
+     * always find one.
+     * @param instruction
+     */
+    [[nodiscard]] bool Full(Instruction instruction) const;
 
     bool Add(const RSEntry& entry);
 
     void Clear();
 
-private:
-    constexpr static SizeType kEntryNumber_ = 32;
+    /**
+     * Drop the entries younger than a mispredicted branch, and the results
+     * being calculated for them.
+     * @param branch the tag of the branch
+     */
+    void Squash(BranchMask branch);
+
+    /**
+     * Remove the resolved branches from the branch masks.
+     * @param branches
+     */
+    void ResolveBranches(BranchMask branches);
+
+    /**
+     * Print the average entries in use and how often the entries are full
+     * for each kind of ALU.
+     * @param out
+     */
+    void PrintOccupancy(std::ostream& out) const;
 
-    void FetchResult(ReorderBuffer& reorderBuffer);
-
-    void UpdateBusyState(const ReorderBuffer& reorderBuffer);
+private:
+    using EntryMask = BitMask<kMaxEntries>;
+
+    enum Unit {
+        addUnit,
+        shiftUnit,
+        setUnit,
+        logicUnit,
+        unitCount
+    };
+
+    /**
+     * Get the kind of ALU of an instruction, or unitCount if it is not
+     * executed by the ALUs.
+     */
+    static Unit GetUnit(Instruction instruction);
+
+    /**
+     * @struct ResolvedBranches
+     * The branches resolved in a cycle.
+     */
+    struct ResolvedBranches {
+        BranchMask correct = 0;
+        bool       mispredicted = false;
+        SizeType   oldestMispredicted = 0; // the RoB index
+        SizeType   oldestTag = 0;
+    };
+
+    /**
+     * Write the results of the ALUs into the physical registers, or into the
+     * RoB for the branches.
+     * @param reorderBuffer
+     * @param registerFile
+     * @param branches the branches resolved
+     */
+    void FetchResult(ReorderBuffer& reorderBuffer, RegisterFile& registerFile,
+                     ResolvedBranches& branches);
+
+    /**
+     * Wake up the entries waiting for the physical registers broadcast.
+     * @param registerFile
+     */
+    void UpdateBusyState(const RegisterFile& registerFile);
 
     void PushDataIntoALU();
 
-    RSEntry entries_[kEntryNumber_];
-    RSEntry nextEntries_[kEntryNumber_];
+    /**
+     * Get the oldest of some entries.
+     * @param entries not empty
+     */
+    [[nodiscard]] SizeType Oldest(const EntryMask& entries) const;
+
+    /**
+     * Start the lowest or the oldest ready entries on the ALUs of a kind that
+     * are ready for them.
+     * @param alus
+     * @param requests the ready entries for the ALUs
+     */
+    template<class ALUType, SizeType kCount>
+    void Select(ALUType (&alus)[kCount], EntryMask requests);
+
+    std::vector<RSEntry> entries_;
+    EntryMask            all_; // the entries within the size
+
+    EntryMask used_;
+    EntryMask nextUsed_;
+    EntryMask waiting_;
+    EntryMask nextWaiting_;
+    EntryMask executing_;
+    EntryMask nextExecuting_;
+    EntryMask units_[unitCount]; // the entries for each kind of ALU
+    EntryMask queues_[unitCount]; // the entries each kind of ALU may take
+    bool      split_;
+
+    std::vector<EntryMask> older_; // the entries added before each entry
+    std::vector<EntryMask> consumers_; // the entries waiting for each physical register
+    bool                   oldestFirst_;
+    Timing                 timings_[kInstructionCount];
+
+    SizeType cycles_ = 0;
+    SizeType occupancy_[unitCount] = {0}; // the entries in use, summed over the cycles
+    SizeType fullCycles_[unitCount] = {0}; // the cycles with no free entry
 
     AddALU   addALU_[2];
     ShiftALU shiftALU_[2];
@@ -0,0 +1,119 @@
+// RISC-V Simulator
+// Copyright (C) 2022 Lau Yee-Yu
+//
+// This library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+
+#ifndef RISC_V_SIMULATOR_INCLUDE_RETURN_ADDRESS_STACK_H
+#define RISC_V_SIMULATOR_INCLUDE_RETURN_ADDRESS_STACK_H
+
+#include "type.h"
+
+enum class StackOperation : ByteType {
+    none,
+    push, // call
+    pop, // return
+    popAndPush // return through the other link register, then call
+};
+
+/**
+ * @class ReturnAddressStack
+ * The return address stack (RAS) predicts the targets of returns.  The
+ * instruction unit updates the speculative stack at issue, and the reorder
+ * buffer updates a second copy at commit.  On a pipeline clear the
+ * speculative stack is restored from the committed one, and on an early
+ * recovery from a copy saved with the mispredicted instruction.  The oldest
+ * entry is overwritten when the stack overflows.
+ */
+class ReturnAddressStack {
+public:
+    constexpr static SizeType kDepth = 16;
+
+private:
+    struct Stack {
+        WordType entries[kDepth] = {0};
+        SizeType top = 0; // the index of the next push
+        SizeType size = 0;
+
+        void Push(WordType returnAddress);
+        bool Pop(WordType& returnAddress);
+    };
+
+public:
+    /**
+     * @struct Checkpoint
+     * A copy of the speculative stack.  Keeping only its position and top
+     * entry is not enough: a wrong path that returns twice and then calls
+     * overwrites an entry below the top.
+     */
+    struct Checkpoint {
+        Stack stack;
+    };
+
+    ReturnAddressStack() = default;
+    ReturnAddressStack(const ReturnAddressStack&) = default;
+    ReturnAddressStack(ReturnAddressStack&&) = default;
+
+    ReturnAddressStack& operator=(const ReturnAddressStack&) = default;
+    ReturnAddressStack& operator=(ReturnAddressStack&&) = default;
+
+    ~ReturnAddressStack() = default;
+
+    void Push(WordType returnAddress);
+
+    /**
+     * Pop the predicted return address.
+     * @param returnAddress the prediction if the stack is not empty
+     * @return false if the stack is empty
+     */
+    bool Pop(WordType& returnAddress);
+
+    /**
+     * Apply the operation of a committed instruction to the committed stack.
+     * @param operation
+     * @param returnAddress the address pushed by a call
+     */
+    void Commit(StackOperation operation, WordType returnAddress);
+
+    /**
+     * Discard the speculative operations.
+     */
+    void Restore();
+
+    [[nodiscard]] Checkpoint Save() const;
+
+    /**
+     * Discard the speculative operations after the checkpoint.
+     * @param checkpoint
+     */
+    void Restore(const Checkpoint& checkpoint);
+
+    /**
+     * Record whether a predicted return went to the predicted address.
+     * @param hit
+     */
+    void Record(bool hit);
+
+    [[nodiscard]] SizeType Hits() const;
+
+    [[nodiscard]] SizeType Misses() const;
+
+private:
+    Stack    speculative_;
+    Stack    committed_;
+    SizeType hits_ = 0;
+    SizeType misses_ = 0;
+};
+
+#endif //RISC_V_SIMULATOR_INCLUDE_RETURN_ADDRESS_STACK_H
@@ -0,0 +1,113 @@
+// RISC-V Simulator
+// Copyright (C) 2022 Lau Yee-Yu
+//
+// This library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+
+#ifndef RISC_V_SIMULATOR_INCLUDE_TARGET_PREDICTOR_H
+#define RISC_V_SIMULATOR_INCLUDE_TARGET_PREDICTOR_H
+
+#include "type.h"
+
+/**
+ * @class TargetPredictor
+ * The target predictor of the indirect jumps other than returns.  It holds
+ * a branch target buffer (BTB) with the last target of each jump, and a
+ * target cache indexed by the jump address and the path history of the
+ * recent targets, which tells apart the targets of a jump reached through
+ * different paths.  The target cache is used if it has an entry for the
+ * jump; otherwise the BTB is used.  Both are updated at commit.  The path
+ * history holds the targets of all the JALRs, returns included.  It is
+ * updated speculatively at issue, and restored from the history
+ * of the committed jumps on a pipeline clear.
+ */
+class TargetPredictor {
+public:
+    constexpr static SizeType kBufferSize = 512; // the number of BTB entries
+    constexpr static SizeType kCacheSize = 512; // the number of target cache entries
+    constexpr static SizeType kHistoryBits = 9;
+
+    struct Entry {
+        bool     valid = false;
+        WordType address = 0;
+        WordType target = 0;
+    };
+
+    TargetPredictor() = default;
+    TargetPredictor(const TargetPredictor&) = default;
+    TargetPredictor(TargetPredictor&&) = default;
+
+    TargetPredictor& operator=(const TargetPredictor&) = default;
+    TargetPredictor& operator=(TargetPredictor&&) = default;
+
+    ~TargetPredictor() = default;
+
+    /**
+     * Predict the target of the jump.
+     * @param instructionAddress
+     * @param target the prediction if there is one
+     * @return false if the jump is not known
+     */
+    bool Predict(WordType instructionAddress, WordType& target) const;
+
+    /**
+     * Add the target of an issued jump to the speculative path history.
+     * @param target
+     */
+    void Speculate(WordType target);
+
+    /**
+     * Discard the speculative path history.
+     */
+    void Restore();
+
+    [[nodiscard]] WordType History() const;
+
+    /**
+     * Set the speculative path history back to a value got from History().
+     * @param history
+     */
+    void Restore(WordType history);
+
+    /**
+     * Learn the target of a committed jump.
+     * @param instructionAddress
+     * @param target
+     */
+    void Update(WordType instructionAddress, WordType target);
+
+    /**
+     * Record whether a predicted jump went to the predicted address.
+     * @param hit
+     */
+    void Record(bool hit);
+
+    [[nodiscard]] SizeType Hits() const;
+
+    [[nodiscard]] SizeType Misses() const;
+
+private:
+    [[nodiscard]] static SizeType CacheIndex(WordType instructionAddress, WordType history);
+
+    [[nodiscard]] static WordType NextHistory(WordType history, WordType target);
+
+    Entry    buffer_[kBufferSize];
+    Entry    cache_[kCacheSize];
+    WordType history_ = 0;
+    WordType speculativeHistory_ = 0;
+    SizeType hits_ = 0;
+    SizeType misses_ = 0;
+};
+
+#endif //RISC_V_SIMULATOR_INCLUDE_TARGET_PREDICTOR_H
@@ -0,0 +1,41 @@
+#!/usr/bin/env python3
+# RISC-V Simulator
+# Copyright (C) 2022 Lau Yee-Yu
+#
+# This library is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+"""Write the hex image used to time the startup of the simulator.
+
+The image holds 2 MB of data, which also fits the 2048000-byte memory of
+the original loader, and its first instruction terminates the program, so
+that the run time is the time to load the image.
+
+Usage: startup_image.py [size in bytes] > startup.data
+"""
+
+import sys
+
+
+def main():
+    size = int(sys.argv[1]) if len(sys.argv) > 1 else 2000000
+    out = sys.stdout
+    out.write("@00000000\n")
+    data = bytearray(i * 37 % 256 for i in range(size))
+    data[0:4] = bytes([0x13, 0x05, 0xF0, 0x0F])  # li a0, 255: the end of the program
+    for line in range(0, size, 16):
+        out.write(" ".join("%02X" % byte for byte in data[line:line + 16]) + " \n")
+
+
+if __name__ == "__main__":
+    main()
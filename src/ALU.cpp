@@ -19,77 +19,89 @@
 #include "type.h"
 
 void ALU::Flush() {
-    if (busy) {
-        busy = false;
-        finished = true;
-    } else {
-        finished = false;
-    }
-    result = nextResult;
-    index = nextIndex;
+    pipeline[now % kStages].valid = false;
+    ++now;
+}
+
+WordType ALU::Result()   const { return pipeline[now % kStages].result; }
+WordType ALU::Index()    const { return pipeline[now % kStages].index;  }
+bool     ALU::Finished() const { return pipeline[now % kStages].valid;  }
+
+bool ALU::Ready(const Timing& timing) const {
+    return now >= nextStart && !pipeline[(now + timing.latency) % kStages].valid;
 }
 
-WordType ALU::Result()   const { return result;   }
-WordType ALU::Index()    const { return index;    }
-bool     ALU::Busy()     const { return busy;     }
-bool     ALU::Finished() const { return finished; }
+void ALU::Start(WordType value, SizeType place, const Timing& timing) {
+    Operation& operation = pipeline[(now + timing.latency) % kStages];
+    operation.valid = true;
+    operation.result = value;
+    operation.index = place;
+    nextStart = now + timing.interval;
+}
 
-void ALU::Clear() { busy = false; }
+void ALU::Clear() {
+    for (auto& operation : pipeline) operation.valid = false;
+    nextStart = now;
+}
 
-void AddALU::Execute(WordType input1, WordType input2, SizeType place, Instruction instruction) {
-    busy = true;
+void AddALU::Execute(WordType input1, WordType input2, SizeType place, Instruction instruction,
+                     const Timing& timing) {
+    WordType value = 0;
     if (instruction == Instruction::SUB) {
-        this->nextResult = input1 - input2;
+        value = input1 - input2;
     } else { // ADDI & ADD
-        this->nextResult = input1 + input2;
+        value = input1 + input2;
     }
-    this->nextIndex = place;
+    Start(value, place, timing);
 }
 
-void ShiftALU::Execute(WordType input1, WordType input2, SizeType place, Instruction instruction) {
-    busy = true;
+void ShiftALU::Execute(WordType input1, WordType input2, SizeType place, Instruction instruction,
+                       const Timing& timing) {
+    WordType value = 0;
     if (instruction == Instruction::SLL || instruction == Instruction::SLLI) {
-        this->nextResult = input1 << input2;
+        value = input1 << input2;
     } else if (instruction == Instruction::SRL || instruction == Instruction::SRLI) {
-        this->nextResult = input1 >> input2;
+        value = input1 >> input2;
     } else { // SRA & SRAI
-        this->nextResult = static_cast<SignedWordType>(input1) >> input2;
+        value = static_cast<SignedWordType>(input1) >> input2;
     }
-    this->nextIndex = place;
+    Start(value, place, timing);
 }
 
-void SetALU::Execute(WordType input1, WordType input2, SizeType place, Instruction instruction) {
-    busy = true;
+void SetALU::Execute(WordType input1, WordType input2, SizeType place, Instruction instruction,
+                     const Timing& timing) {
+    WordType value = 0;
     if (instruction == Instruction::SLT ||
         instruction == Instruction::SLTI ||
         instruction == Instruction::BLT) {
-        this->nextResult = static_cast<WordType>(
+        value = static_cast<WordType>(
             static_cast<SignedWordType>(input1) < static_cast<SignedWordType>(input2));
     } else if (instruction == Instruction::SLTU ||
                instruction == Instruction::SLTIU ||
                instruction == Instruction::BLTU) { // SLTU & SLTIU
-        this->nextResult = static_cast<WordType>(input1 < input2);
+        value = static_cast<WordType>(input1 < input2);
     } else if (instruction == Instruction::BEQ) {
-        this->nextResult = static_cast<WordType>(input1 == input2);
+        value = static_cast<WordType>(input1 == input2);
     } else if (instruction == Instruction::BNE) {
-        this->nextResult = static_cast<WordType>(input1 != input2);
+        value = static_cast<WordType>(input1 != input2);
     } else if (instruction == Instruction::BGE) {
-        this->nextResult = static_cast<WordType>(
+        value = static_cast<WordType>(
             static_cast<SignedWordType>(input1) >= static_cast<SignedWordType>(input2));
     } else if (instruction == Instruction::BGEU) {
-        this->nextResult = static_cast<WordType>(input1 >= input2);
+        value = static_cast<WordType>(input1 >= input2);
     }
-    this->nextIndex = place;
+    Start(value, place, timing);
 }
 
-void LogicALU::Execute(WordType input1, WordType input2, SizeType place, Instruction instruction) {
-    busy = true;
+void LogicALU::Execute(WordType input1, WordType input2, SizeType place, Instruction instruction,
+                       const Timing& timing) {
+    WordType value = 0;
     if (instruction == Instruction::XOR || instruction == Instruction::XORI) {
-        this->nextResult = input1 ^ input2;
+        value = input1 ^ input2;
     } else if (instruction == Instruction::OR || instruction == Instruction::ORI) {
-        this->nextResult = input1 | input2;
+        value = input1 | input2;
     } else { // AND & ANDI
-        this->nextResult = input1 & input2;
+        value = input1 & input2;
     }
-    this->nextIndex = place;
+    Start(value, place, timing);
 }
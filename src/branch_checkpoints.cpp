@@ -0,0 +1,42 @@
+// RISC-V Simulator
+// Copyright (C) 2022 Lau Yee-Yu
+//
+// This library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "branch_checkpoints.h"
+
+BranchCheckpoints::BranchCheckpoints(SizeType count)
+    : all_(count >= kMaxCount ? ~BranchMask{0} : (BranchMask{1} << count) - 1) {}
+
+bool BranchCheckpoints::Full() const { return active_ == all_; }
+
+BranchMask BranchCheckpoints::Active() const { return active_; }
+
+SizeType BranchCheckpoints::Allocate(const BranchCheckpoint& checkpoint) {
+    SizeType tag = 0;
+    while (active_ >> tag & 1) ++tag;
+    active_ |= BranchMask{1} << tag;
+    checkpoints_[tag] = checkpoint;
+    return tag;
+}
+
+const BranchCheckpoint& BranchCheckpoints::Get(SizeType tag) const { return checkpoints_[tag]; }
+
+void BranchCheckpoints::Free(BranchMask branches) {
+    active_ &= ~branches;
+    // the tags may be taken again by younger branches
+    for (auto& checkpoint : checkpoints_) checkpoint.olderBranches &= ~branches;
+}
+
+void BranchCheckpoints::Clear() { active_ = 0; }
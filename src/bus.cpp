@@ -16,26 +16,35 @@
 
 #include "bus.h"
 
+#include <utility>
+
+#include "image.h"
 #include "instructions.h"
 #include "memory.h"
 #include "register.h"
 #include "reorder_buffer.h"
 
-Bus::Bus() : memory_(2048000),
-             instructionUnit_(),
-             registerFile_(),
-             reorderBuffer_(),
-             reservationStation_(),
-             loadStoreBuffer_() {};
+Bus::Bus(std::shared_ptr<const ProgramImage> image, const Config& config)
+    : config_(config),
+      instructionUnit_(config),
+      memory_(),
+      registerFile_(config.physicalRegisters),
+      reorderBuffer_(config),
+      reservationStation_(config),
+      loadStoreBuffer_(config),
+      branchCheckpoints_(config.branchCheckpoints) {
+    instructionUnit_.SetPC(image->Entry());
+    memory_.Load(std::move(image));
+}
 
-void Bus::RegisterCommit(SizeType index, WordType value, SizeType dependency) {
-    registerFile_.Write(index, value, dependency);
+void Bus::RegisterCommit(SizeType index, SizeType physical, SizeType previous, bool moved) {
+    registerFile_.Commit(index, physical, previous, moved);
 }
 
 void Bus::Flush() {
-    registerFile_.Flush();
     reorderBuffer_.Flush();
     reservationStation_.Flush();
+    registerFile_.Flush();
 }
 
 void Bus::SetPC(WordType pc) { instructionUnit_.SetPC(pc); }
@@ -45,32 +54,96 @@ ReorderBuffer&      Bus::GetReorderBuffer()      { return reorderBuffer_;      }
 LoadStoreBuffer&    Bus::GetLoadStoreBuffer()    { return loadStoreBuffer_;    }
 RegisterFile&       Bus::GetRegisterFile()       { return registerFile_;       }
 ReservationStation& Bus::GetReservationStation() { return reservationStation_; }
+BranchCheckpoints&  Bus::GetBranchCheckpoints()  { return branchCheckpoints_;  }
 
 void Bus::ClearPipeline() {
-    registerFile_.ResetDependency();
+    registerFile_.Reset();
     reorderBuffer_.Clear();
     reservationStation_.Clear();
     loadStoreBuffer_.ClearOnWrongPrediction();
     instructionUnit_.ResetStateOnClearPipeline();
+    branchCheckpoints_.Clear();
+}
+
+void Bus::RecoverBranch(SizeType index) {
+    // before the commit of this cycle, so the older entries are all in the RoB
+    const ReorderBufferEntry& branch = reorderBuffer_[index];
+    const BranchCheckpoint& checkpoint = branchCheckpoints_.Get(branch.checkpoint);
+    BranchMask tag = BranchMask{1} << branch.checkpoint;
+    registerFile_.Restore(checkpoint.registers);
+    reorderBuffer_.SquashAfter(index);
+    reservationStation_.Squash(tag);
+    loadStoreBuffer_.Squash(tag);
+    instructionUnit_.Recover(checkpoint, branch.address, static_cast<bool>(branch.value),
+                             branch.index);
+    // the branch and the younger ones
+    branchCheckpoints_.Free(branchCheckpoints_.Active() & ~checkpoint.olderBranches);
+}
+
+void Bus::ResolveBranches(BranchMask branches) {
+    reservationStation_.ResolveBranches(branches);
+    loadStoreBuffer_.ResolveBranches(branches);
+    branchCheckpoints_.Free(branches);
 }
 
 void Bus::Run() {
-    while (true) {
+    while (!halted_) {
         loadStoreBuffer_.Execute(*this);
         instructionUnit_.FetchAndPush(*this);
-        reservationStation_.Execute(reorderBuffer_);
+        reservationStation_.Execute(*this);
         reorderBuffer_.TryCommit(*this);
         ++clock_;
         Flush();
     }
 }
 
+void Bus::Halt(int exitCode) {
+    halted_ = true;
+    exitCode_ = exitCode;
+}
+
+int Bus::ExitCode() const { return exitCode_; }
+
 long Bus::Clock() const { return clock_; }
 
-void Bus::UpdatePredictor(WordType instructionAddress, bool answer) {
-    instructionUnit_.GetPredictor().Update(instructionAddress, answer);
+const Config& Bus::GetConfig() const { return config_; }
+
+void Bus::UpdatePredictor(WordType instructionAddress, bool answer, bool prediction) {
+    instructionUnit_.GetPredictor().Update(instructionAddress, answer, prediction);
 }
 
+Predictor& Bus::GetPredictor() { return instructionUnit_.GetPredictor(); }
+
 float Bus::PredictorAccuracy() const {
     return instructionUnit_.PredictorAccuracy();
 }
+
+void Bus::CommitReturnAddress(StackOperation operation, WordType returnAddress) {
+    instructionUnit_.GetReturnAddressStack().Commit(operation, returnAddress);
+}
+
+ReturnAddressStack& Bus::GetReturnAddressStack() {
+    return instructionUnit_.GetReturnAddressStack();
+}
+
+void Bus::UpdateTargetPredictor(WordType instructionAddress, WordType target) {
+    instructionUnit_.GetTargetPredictor().Update(instructionAddress, target);
+}
+
+TargetPredictor& Bus::GetTargetPredictor() { return instructionUnit_.GetTargetPredictor(); }
+
+void Bus::InvalidateDecoded(WordType address, SizeType size) {
+    instructionUnit_.InvalidateDecoded(address, size);
+}
+
+float Bus::DecodeCacheHitRate() const {
+    return instructionUnit_.DecodeCacheHitRate();
+}
+
+SizeType Bus::EliminatedInstructions() const {
+    return instructionUnit_.Eliminated();
+}
+
+void Bus::PrintFusionStatistics(std::ostream& out) const {
+    instructionUnit_.PrintFusionStatistics(out);
+}
@@ -0,0 +1,350 @@
+// RISC-V Simulator
+// Copyright (C) 2022 Lau Yee-Yu
+//
+// This library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "image.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <map>
+
+#ifdef LAU_TEST
+#include <chrono>
+#include <iostream>
+#endif
+
+#include "hex_decoder.h"
+
+namespace {
+
+constexpr char kMagic[8] = {'R', 'V', 'S', 'I', 'M', 'I', 'M', 'G'};
+
+struct Header {
+    char     magic[8];
+    uint32_t version;
+    uint32_t entry;
+    uint32_t sectionCount;
+    uint32_t checksum;
+    uint32_t reserved[2];
+};
+
+struct SectionRecord {
+    uint32_t address;
+    uint32_t size;
+    uint32_t offset;
+    uint32_t reserved;
+};
+
+static_assert(sizeof(Header) == 32);
+static_assert(sizeof(SectionRecord) == 16);
+
+constexpr char     kElfMagic[4] = {0x7F, 'E', 'L', 'F'};
+constexpr ByteType kElfClass32 = 1;
+constexpr ByteType kElfLittleEndian = 1;
+constexpr uint16_t kElfExecutable = 2;
+constexpr uint16_t kElfRISCV = 243;
+constexpr uint32_t kElfLoad = 1;
+
+struct ElfHeader {
+    ByteType identification[16];
+    uint16_t type;
+    uint16_t machine;
+    uint32_t version;
+    uint32_t entry;
+    uint32_t programHeaderOffset;
+    uint32_t sectionHeaderOffset;
+    uint32_t flags;
+    uint16_t headerSize;
+    uint16_t programHeaderSize;
+    uint16_t programHeaderCount;
+    uint16_t sectionHeaderSize;
+    uint16_t sectionHeaderCount;
+    uint16_t sectionNameIndex;
+};
+
+struct ElfProgramHeader {
+    uint32_t type;
+    uint32_t offset;
+    uint32_t virtualAddress;
+    uint32_t physicalAddress;
+    uint32_t fileSize;
+    uint32_t memorySize;
+    uint32_t flags;
+    uint32_t align;
+};
+
+static_assert(sizeof(ElfHeader) == 52);
+static_assert(sizeof(ElfProgramHeader) == 32);
+
+constexpr WordType kFNVOffsetBasis = 2166136261u;
+constexpr WordType kFNVPrime = 16777619u;
+
+WordType Checksum(WordType hash, const ByteType* data, SizeType size) {
+    for (SizeType i = 0; i < size; ++i) {
+        hash = (hash ^ data[i]) * kFNVPrime;
+    }
+    return hash;
+}
+
+SizeType AlignToPage(SizeType size) {
+    return (size + ProgramImage::kPageSize - 1) / ProgramImage::kPageSize * ProgramImage::kPageSize;
+}
+
+using PageMap = std::map<WordType, std::vector<ByteType>>;
+
+ByteType* GetPage(PageMap& pages, WordType page) {
+    auto& data = pages[page];
+    if (data.empty()) data.resize(ProgramImage::kPageSize, 0);
+    return data.data();
+}
+
+} // namespace
+
+ProgramImage::ProgramImage(ProgramImage&& other) noexcept
+    : mapping_(other.mapping_),
+      mappingSize_(other.mappingSize_),
+      entry_(other.entry_),
+      storage_(std::move(other.storage_)),
+      sections_(std::move(other.sections_)) {
+    other.mapping_ = nullptr;
+    other.mappingSize_ = 0;
+}
+
+ProgramImage& ProgramImage::operator=(ProgramImage&& other) noexcept {
+    if (this == &other) return *this;
+    Close();
+    mapping_ = other.mapping_;
+    mappingSize_ = other.mappingSize_;
+    entry_ = other.entry_;
+    storage_ = std::move(other.storage_);
+    sections_ = std::move(other.sections_);
+    other.mapping_ = nullptr;
+    other.mappingSize_ = 0;
+    return *this;
+}
+
+ProgramImage::~ProgramImage() { Close(); }
+
+void ProgramImage::Close() {
+    if (mapping_ != nullptr) {
+        munmap(const_cast<ByteType*>(mapping_), mappingSize_);
+        mapping_ = nullptr;
+    }
+    mappingSize_ = 0;
+    storage_.clear();
+    sections_.clear();
+    entry_ = 0;
+}
+
+bool ProgramImage::Open(const char* path) {
+    Close();
+    int descriptor = open(path, O_RDONLY);
+    if (descriptor == -1) return false;
+    struct stat status{};
+    void* mapping = MAP_FAILED;
+    if (fstat(descriptor, &status) == 0 &&
+        static_cast<std::size_t>(status.st_size) >= sizeof(Header) &&
+        static_cast<std::size_t>(status.st_size) <= 0xFFFFFFFFu) {
+        mapping = mmap(nullptr, status.st_size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+    }
+    close(descriptor);
+    if (mapping == MAP_FAILED) return false;
+    mapping_ = static_cast<const ByteType*>(mapping);
+    mappingSize_ = static_cast<SizeType>(status.st_size);
+
+    bool valid = std::memcmp(mapping_, kElfMagic, sizeof(kElfMagic)) == 0 ? ParseElf()
+                                                                           : ParseBinary();
+    if (!valid) Close();
+    return valid;
+}
+
+bool ProgramImage::ParseBinary() {
+    Header header{};
+    std::memcpy(&header, mapping_, sizeof(Header));
+    SizeType tableSize = header.sectionCount * sizeof(SectionRecord);
+    if (std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0 ||
+        header.version != kVersion ||
+        header.sectionCount > (mappingSize_ - sizeof(Header)) / sizeof(SectionRecord)) {
+        return false;
+    }
+    const ByteType* table = mapping_ + sizeof(Header);
+    WordType checksum = Checksum(kFNVOffsetBasis, table, tableSize);
+    for (SizeType i = 0; i < header.sectionCount; ++i) {
+        SectionRecord record{};
+        std::memcpy(&record, table + i * sizeof(SectionRecord), sizeof(SectionRecord));
+        if (record.address % kPageSize != 0 || record.size % kPageSize != 0 ||
+            record.offset % kPageSize != 0 || record.offset > mappingSize_ ||
+            record.size > mappingSize_ - record.offset ||
+            static_cast<uint64_t>(record.address) + record.size > (uint64_t(1) << 32)) {
+            return false;
+        }
+        sections_.push_back({record.address, record.size, record.offset, record.size});
+        checksum = Checksum(checksum, mapping_ + record.offset, record.size);
+    }
+    if (checksum != header.checksum) return false;
+    entry_ = header.entry;
+    return true;
+}
+
+bool ProgramImage::ParseElf() {
+    ElfHeader header{};
+    if (mappingSize_ < sizeof(ElfHeader)) return false;
+    std::memcpy(&header, mapping_, sizeof(ElfHeader));
+    if (header.identification[4] != kElfClass32 ||
+        header.identification[5] != kElfLittleEndian ||
+        header.type != kElfExecutable || header.machine != kElfRISCV ||
+        header.programHeaderSize < sizeof(ElfProgramHeader) ||
+        header.programHeaderOffset > mappingSize_ ||
+        static_cast<uint64_t>(header.programHeaderCount) * header.programHeaderSize >
+            mappingSize_ - header.programHeaderOffset) {
+        return false;
+    }
+    for (SizeType i = 0; i < header.programHeaderCount; ++i) {
+        ElfProgramHeader segment{};
+        std::memcpy(&segment,
+                    mapping_ + header.programHeaderOffset + i * header.programHeaderSize,
+                    sizeof(ElfProgramHeader));
+        if (segment.type != kElfLoad || segment.memorySize == 0) continue;
+        if (segment.fileSize > segment.memorySize || segment.offset > mappingSize_ ||
+            segment.fileSize > mappingSize_ - segment.offset ||
+            static_cast<uint64_t>(segment.virtualAddress) + segment.memorySize >
+                (uint64_t(1) << 32)) {
+            return false;
+        }
+        // The part beyond the file size (.bss) is zeroed when it is loaded.
+        sections_.push_back({segment.virtualAddress, segment.memorySize,
+                             segment.offset, segment.fileSize});
+    }
+    entry_ = header.entry;
+    return true;
+}
+
+WordType ProgramImage::Entry() const { return entry_; }
+
+const std::vector<ProgramImage::Section>& ProgramImage::Sections() const { return sections_; }
+
+const ByteType* ProgramImage::Data(const Section& section) const {
+    return (mapping_ != nullptr ? mapping_ : storage_.data()) + section.offset;
+}
+
+bool ProgramImage::ReadHex(std::FILE* input) {
+    Close();
+#ifdef LAU_TEST
+    auto start = std::chrono::steady_clock::now();
+#endif
+    PageMap pages;
+    WordType  lastPage = 0;
+    ByteType* lastData = nullptr;
+    auto store = [&](WordType address, ByteType value) {
+        WordType page = address / kPageSize;
+        if (lastData == nullptr || page != lastPage) {
+            lastPage = page;
+            lastData = GetPage(pages, page);
+        }
+        lastData[address % kPageSize] = value;
+    };
+    constexpr SizeType kBlockSize = 1 << 16;
+    char buffer[kBlockSize];
+    HexDecoder decoder;
+    std::size_t count;
+    while ((count = std::fread(buffer, 1, kBlockSize, input)) > 0) {
+        if (!decoder.Decode(buffer, buffer + count, store)) return false;
+    }
+    if (!decoder.Finish(store)) return false;
+
+    for (const auto& [page, data] : pages) {
+        if (!sections_.empty() &&
+            sections_.back().address + sections_.back().size == page * kPageSize) {
+            sections_.back().size += kPageSize;
+            sections_.back().fileSize += kPageSize;
+        } else {
+            sections_.push_back({page * kPageSize, kPageSize,
+                                 static_cast<SizeType>(storage_.size()), kPageSize});
+        }
+        storage_.insert(storage_.end(), data.begin(), data.end());
+    }
+#ifdef LAU_TEST
+    std::cerr << "Image loaded in "
+              << std::chrono::duration<double, std::milli>(
+                     std::chrono::steady_clock::now() - start).count()
+              << " ms." << std::endl;
+#endif
+    return true;
+}
+
+bool ProgramImage::Save(const char* path) const {
+    // Lay the image out again page by page, since the sections of an ELF
+    // executable are not page-aligned.
+    PageMap pages;
+    for (const auto& section : sections_) {
+        for (SizeType i = 0; i < section.size;) {
+            WordType address = section.address + i;
+            SizeType offset = address % kPageSize;
+            SizeType chunk = std::min(section.size - i, kPageSize - offset);
+            SizeType copied = i < section.fileSize ? std::min(chunk, section.fileSize - i) : 0;
+            ByteType* data = GetPage(pages, address / kPageSize) + offset;
+            std::memcpy(data, Data(section) + i, copied);
+            std::memset(data + copied, 0, chunk - copied);
+            i += chunk;
+        }
+    }
+
+    std::vector<SectionRecord> records;
+    for (const auto& [page, data] : pages) {
+        if (!records.empty() &&
+            records.back().address + records.back().size == page * kPageSize) {
+            records.back().size += kPageSize;
+        } else {
+            records.push_back({page * kPageSize, kPageSize, 0, 0});
+        }
+    }
+    SizeType offset = AlignToPage(sizeof(Header) + records.size() * sizeof(SectionRecord));
+    for (auto& record : records) {
+        record.offset = offset;
+        offset += record.size;
+    }
+
+    Header header{};
+    std::memcpy(header.magic, kMagic, sizeof(kMagic));
+    header.version = kVersion;
+    header.entry = entry_;
+    header.sectionCount = records.size();
+    header.checksum = Checksum(kFNVOffsetBasis,
+                               reinterpret_cast<const ByteType*>(records.data()),
+                               records.size() * sizeof(SectionRecord));
+    for (const auto& [page, data] : pages) {
+        header.checksum = Checksum(header.checksum, data.data(), kPageSize);
+    }
+
+    std::FILE* output = std::fopen(path, "wb");
+    if (output == nullptr) return false;
+    bool success = std::fwrite(&header, sizeof(Header), 1, output) == 1;
+    if (!records.empty()) {
+        success = success && std::fwrite(records.data(), sizeof(SectionRecord),
+                                         records.size(), output) == records.size();
+    }
+    std::vector<ByteType> padding(records.empty() ? 0 : records.front().offset -
+                                  sizeof(Header) - records.size() * sizeof(SectionRecord), 0);
+    success = success && std::fwrite(padding.data(), 1, padding.size(), output) == padding.size();
+    for (const auto& [page, data] : pages) {
+        success = success && std::fwrite(data.data(), 1, kPageSize, output) == kPageSize;
+    }
+    return std::fclose(output) == 0 && success;
+}
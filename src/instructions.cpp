@@ -16,20 +16,30 @@
 
 #include "instructions.h"
 
+#include <array>
 #include <cassert>
+#include <cmath>
 #include <cstdlib>
+#include <iomanip>
 #include <iostream>
 
+#include "branch_checkpoints.h"
 #include "bus.h"
 #include "load_store_buffer.h"
 #include "reorder_buffer.h"
 #include "type.h"
 
-InstructionUnit::InstructionUnit() : stall_(false),
-                                     immediate_(0),
-                                     dependency_(0),
-                                     PC_(),
-                                     predictor_() {
+InstructionUnit::InstructionUnit(const Config& config) : issueWidth_(config.issueWidth),
+                                                         fetchWidth_(config.fetchWidth == 0
+                                                                     ? config.issueWidth
+                                                                     : config.fetchWidth),
+                                                         predictReturns_(config.returnAddressStack),
+                                                         predictJumps_(config.targetPredictor),
+                                                         stall_(false),
+                                                         immediate_(0),
+                                                         dependency_(0),
+                                                         PC_(),
+                                                         predictor_(Predictor::Create(config.predictor)) {
     PC_ = 0;
 }
 
@@ -81,275 +91,466 @@ WordType GetStoreImmediate(WordType instruction) {
 /// 24:20 shift amount
 WordType GetShiftAmount(WordType instruction) { return (instruction >> 20) & 0b11111; }
 
-/// 14:12
-WordType GetFunction3(WordType instruction) { return (instruction >> 12) & 0b111; }
-
 /// 31:25
 WordType GetFunction7(WordType instruction) { return (instruction >> 25) & 0b1111111; }
 
-Instruction GetBranchInstruction(WordType instruction) {
-    WordType function3 = GetFunction3(instruction);
-    switch (function3) {
-        case 0b000: // BEQ
-            return Instruction::BEQ;
-        case 0b001: // BNE
-            return Instruction::BNE;
-        case 0b100: // BLT
-            return Instruction::BLT;
-        case 0b101: // BGE
-            return Instruction::BGE;
-        case 0b110: // BLTU
-            return Instruction::BLTU;
-        case 0b111: // BGEU
-            return Instruction::BGEU;
-        default:
-            assert(false);
-    }
+bool IsLoad(Instruction instruction) {
+    return instruction == Instruction::LB || instruction == Instruction::LH ||
+           instruction == Instruction::LW || instruction == Instruction::LBU ||
+           instruction == Instruction::LHU;
 }
 
-Instruction GetLoadInstruction(WordType instruction) {// LB & LH & LW & LBU & LHU
-    WordType function3 = GetFunction3(instruction);
-    switch (function3) {
-        case 0b000: // LB
-            return Instruction::LB;
-        case 0b001: // LH
-            return Instruction::LH;
-        case 0b010: // LW
-            return Instruction::LW;
-        case 0b100: // LBU
-            return Instruction::LBU;
-        case 0b101: // LHU
-            return Instruction::LHU;
-        default:
-            assert(false);
+/// x1 (ra) and x5 (t0) are the link registers.
+bool IsLinkRegister(SizeType index) { return index == 1 || index == 5; }
+
+/// The stack operation of JAL and JALR, as hinted in the RISC-V spec.
+StackOperation GetStackOperation(const InstructionInfo& info) {
+    bool call = IsLinkRegister(info.destinationRegister);
+    if (info.instruction == Instruction::JAL) {
+        return call ? StackOperation::push : StackOperation::none;
     }
+    bool ret = IsLinkRegister(info.register1);
+    if (call && ret) {
+        return info.destinationRegister == info.register1 ? StackOperation::push
+                                                          : StackOperation::popAndPush;
+    }
+    if (call) return StackOperation::push;
+    if (ret) return StackOperation::pop;
+    return StackOperation::none;
 }
 
-Instruction GetStoreInstruction(WordType instruction) {
-    WordType function3 = GetFunction3(instruction);
-    switch (function3) {
-        case 0b000: // SB
-            return Instruction::SB;
-        case 0b001: // SH
-            return Instruction::SH;
-        case 0b010: // SW
-            return Instruction::SW;
-        default:
-            assert(false);
-    }
+enum class ImmediateFormat : ByteType {
+    none, // R-type
+    signedLower, // I-type
+    unsignedLower, // SLTIU
+    shiftAmount, // SLLI & SRLI & SRAI
+    store, // S-type
+    branch, // B-type
+    upper, // U-type
+    jump // J-type
+};
+
+struct DecodeEntry {
+    Instruction     instruction = Instruction::ILLEGAL;
+    ImmediateFormat format = ImmediateFormat::none;
+    bool            checkFunction7 = false; // funct7 must be 0b0000000 or 0b0100000
+};
+
+/// The table is indexed by opcode[6:2], funct3 and funct7[5] (bit 30).
+constexpr SizeType kDecodeTableSize = 1 << 9;
+constexpr int      kAnyFunction3 = -1;
+constexpr int      kAnyFunction7 = -1; // bits 31:25 belong to the immediate
+
+using DecodeTable = std::array<DecodeEntry, kDecodeTableSize>;
+
+constexpr SizeType DecodeIndex(WordType opCode, WordType function3, WordType bit30) {
+    return ((opCode >> 2) & 0b11111) << 4 | (function3 & 0b111) << 1 | (bit30 & 1);
 }
 
-Instruction GetImmediateInstruction(WordType instruction) {
-    WordType function3 = GetFunction3(instruction);
-    WordType function7 = GetFunction7(instruction);
-    switch (function3) {
-        case 0b000: // ADDI
-            return Instruction::ADDI;
-        case 0b001: // SLLI
-            return Instruction::SLLI;
-        case 0b010: // SLTI
-            return Instruction::SLTI;
-        case 0b011: // SLTIU
-            return Instruction::SLTIU;
-        case 0b100: // XORI
-            return Instruction::XORI;
-        case 0b101: // SRLI & SRAI
-            switch (function7) {
-                case 0b0000000: // SRLI
-                    return Instruction::SRLI;
-                case 0b0100000: // SRAI
-                    return Instruction::SRAI;
-                default:
-                    assert(false);
-            }
-        case 0b110: // ORI
-            return Instruction::ORI;
-        case 0b111: // ANDI
-            return Instruction::ANDI;
-        default:
-            assert(false);
-    }
+constexpr SizeType DecodeIndex(WordType instruction) {
+    return DecodeIndex(instruction & 0b1111111, instruction >> 12, instruction >> 30);
 }
 
-Instruction GetArithmeticInstruction(WordType instruction) {
-    WordType function3 = GetFunction3(instruction);
-    WordType function7 = GetFunction7(instruction);
-    switch (function3) {
-        case 0b000: // ADD & SUB
-            switch (function7) {
-                case 0b0000000: // ADD
-                    return Instruction::ADD;
-                case 0b0100000: // SUB
-                    return Instruction::SUB;
-                default:
-                    assert(false);
-            }
-        case 0b001: // SLL
-            return Instruction::SLL;
-        case 0b010: // SLT
-            return Instruction::SLT;
-        case 0b011: // SLTU
-            return Instruction::SLTU;
-        case 0b100: // XOR
-            return Instruction::XOR;
-        case 0b101: // SRL & SRA
-            switch (function7) {
-                case 0b0000000: // SRL
-                    return Instruction::SRL;
-                case 0b0100000: // SRA
-                    return Instruction::SRA;
-                default:
-                    assert(false);
-            }
-        case 0b110: // OR
-            return Instruction::OR;
-        case 0b111: // AND
-            return Instruction::AND;
-        default:
-            assert(false);
+constexpr void AddEntry(DecodeTable& table, WordType opCode, int function3, int function7,
+                        Instruction instruction, ImmediateFormat format) {
+    for (WordType f3 = 0; f3 < 8; ++f3) {
+        if (function3 != kAnyFunction3 && static_cast<WordType>(function3) != f3) continue;
+        for (WordType bit30 = 0; bit30 < 2; ++bit30) {
+            if (function7 != kAnyFunction7 &&
+                static_cast<WordType>(function7 >> 5 & 1) != bit30) continue;
+            table[DecodeIndex(opCode, f3, bit30)] = {instruction, format,
+                                                     function7 != kAnyFunction7};
+        }
     }
 }
 
+constexpr DecodeTable MakeDecodeTable() {
+    using F = ImmediateFormat;
+    using I = Instruction;
+    DecodeTable table{};
+    AddEntry(table, 0b0110111, kAnyFunction3, kAnyFunction7, I::LUI, F::upper);
+    AddEntry(table, 0b0010111, kAnyFunction3, kAnyFunction7, I::AUIPC, F::upper);
+    AddEntry(table, 0b1101111, kAnyFunction3, kAnyFunction7, I::JAL, F::jump);
+    AddEntry(table, 0b1100111, 0b000, kAnyFunction7, I::JALR, F::signedLower);
+
+    AddEntry(table, 0b1100011, 0b000, kAnyFunction7, I::BEQ, F::branch);
+    AddEntry(table, 0b1100011, 0b001, kAnyFunction7, I::BNE, F::branch);
+    AddEntry(table, 0b1100011, 0b100, kAnyFunction7, I::BLT, F::branch);
+    AddEntry(table, 0b1100011, 0b101, kAnyFunction7, I::BGE, F::branch);
+    AddEntry(table, 0b1100011, 0b110, kAnyFunction7, I::BLTU, F::branch);
+    AddEntry(table, 0b1100011, 0b111, kAnyFunction7, I::BGEU, F::branch);
+
+    AddEntry(table, 0b0000011, 0b000, kAnyFunction7, I::LB, F::signedLower);
+    AddEntry(table, 0b0000011, 0b001, kAnyFunction7, I::LH, F::signedLower);
+    AddEntry(table, 0b0000011, 0b010, kAnyFunction7, I::LW, F::signedLower);
+    AddEntry(table, 0b0000011, 0b100, kAnyFunction7, I::LBU, F::signedLower);
+    AddEntry(table, 0b0000011, 0b101, kAnyFunction7, I::LHU, F::signedLower);
+
+    AddEntry(table, 0b0100011, 0b000, kAnyFunction7, I::SB, F::store);
+    AddEntry(table, 0b0100011, 0b001, kAnyFunction7, I::SH, F::store);
+    AddEntry(table, 0b0100011, 0b010, kAnyFunction7, I::SW, F::store);
+
+    AddEntry(table, 0b0010011, 0b000, kAnyFunction7, I::ADDI, F::signedLower);
+    AddEntry(table, 0b0010011, 0b010, kAnyFunction7, I::SLTI, F::signedLower);
+    AddEntry(table, 0b0010011, 0b011, kAnyFunction7, I::SLTIU, F::unsignedLower);
+    AddEntry(table, 0b0010011, 0b100, kAnyFunction7, I::XORI, F::signedLower);
+    AddEntry(table, 0b0010011, 0b110, kAnyFunction7, I::ORI, F::signedLower);
+    AddEntry(table, 0b0010011, 0b111, kAnyFunction7, I::ANDI, F::signedLower);
+    AddEntry(table, 0b0010011, 0b001, 0b0000000, I::SLLI, F::shiftAmount);
+    AddEntry(table, 0b0010011, 0b101, 0b0000000, I::SRLI, F::shiftAmount);
+    AddEntry(table, 0b0010011, 0b101, 0b0100000, I::SRAI, F::shiftAmount);
+
+    AddEntry(table, 0b0110011, 0b000, 0b0000000, I::ADD, F::none);
+    AddEntry(table, 0b0110011, 0b000, 0b0100000, I::SUB, F::none);
+    AddEntry(table, 0b0110011, 0b001, 0b0000000, I::SLL, F::none);
+    AddEntry(table, 0b0110011, 0b010, 0b0000000, I::SLT, F::none);
+    AddEntry(table, 0b0110011, 0b011, 0b0000000, I::SLTU, F::none);
+    AddEntry(table, 0b0110011, 0b100, 0b0000000, I::XOR, F::none);
+    AddEntry(table, 0b0110011, 0b101, 0b0000000, I::SRL, F::none);
+    AddEntry(table, 0b0110011, 0b101, 0b0100000, I::SRA, F::none);
+    AddEntry(table, 0b0110011, 0b110, 0b0000000, I::OR, F::none);
+    AddEntry(table, 0b0110011, 0b111, 0b0000000, I::AND, F::none);
+    return table;
+}
+
+constexpr DecodeTable kDecodeTable = MakeDecodeTable();
+
+/**
+ * Decode an instruction.  An unknown encoding is decoded as
+ * Instruction::ILLEGAL with the encoding in the immediate.
+ */
 InstructionInfo GetInstructionInfo(WordType instruction) {
-    InstructionInfo info;
-    ByteType opCode = GetOpCode(instruction);
-    switch (opCode) {
-        case 0b0110111: // LUI
-            info.instruction = Instruction::LUI;
-            info.immediate = GetUpperImmediate(instruction);
-            info.destinationRegister = GetDestinationRegister(instruction);
-            break;
-        case 0b0010111: // AUIPC
-            info.instruction = Instruction::AUIPC;
-            info.immediate = GetUpperImmediate(instruction);
-            info.destinationRegister = GetDestinationRegister(instruction);
-            break;
-        case 0b1101111: // JAL
-            info.instruction = Instruction::JAL;
-            info.immediate = GetJALImmediate(instruction);
-            info.destinationRegister = GetDestinationRegister(instruction);
-            break;
-        case 0b1100111: // JALR
-            info.instruction = Instruction::JALR;
-            info.immediate = GetSignedLowerImmediate(instruction);
-            info.destinationRegister = GetDestinationRegister(instruction);
-            info.register1 = GetRegister1(instruction);
-            break;
-        case 0b1100011: // BEQ & BNE & BLT & BGE & BLTU & BGEU
-            info.instruction = GetBranchInstruction(instruction);
-            info.immediate = GetBranchImmediate(instruction);
-            info.register1 = GetRegister1(instruction);
-            info.register2 = GetRegister2(instruction);
-            break;
-        case 0b0000011: // LB & LH & LW & LBU & LHU
-            info.instruction = GetLoadInstruction(instruction);
-            info.immediate = GetSignedLowerImmediate(instruction);
-            info.destinationRegister = GetDestinationRegister(instruction);
-            info.register1 = GetRegister1(instruction);
-            break;
-        case 0b0100011: // SB & SH & SW
-            info.instruction = GetStoreInstruction(instruction);
-            info.immediate = GetStoreImmediate(instruction);
-            info.register1 = GetRegister1(instruction);
-            info.register2 = GetRegister2(instruction);
-            break;
-        case 0b0010011: // ADDI & SLTI & SLTIU & XORI & ORI & ANDI & SLLI & SRLI & SRAI
-            info.instruction = GetImmediateInstruction(instruction);
-            if (info.instruction == Instruction::SLLI ||
-                info.instruction == Instruction::SRLI ||
-                info.instruction == Instruction::SRAI) {
-                info.immediate = GetShiftAmount(instruction);
-            } else if (info.instruction == Instruction::SLTIU) {
-                info.immediate = GetUnsignedLowerImmediate(instruction);
-            } else {
-                info.immediate = GetSignedLowerImmediate(instruction);
-            }
-            info.destinationRegister = GetDestinationRegister(instruction);
-            info.register1 = GetRegister1(instruction);
-            break;
-        case 0b0110011: // ADD & SUB & SLL & SLT & SLTU & XOR & SRL & SRA & OR & AND
-            info.instruction = GetArithmeticInstruction(instruction);
-            info.destinationRegister = GetDestinationRegister(instruction);
-            info.register1 = GetRegister1(instruction);
-            info.register2 = GetRegister2(instruction);
-            break;
-        default:
-            assert(false);
+    InstructionInfo info{};
+    if (instruction == 0x0ff00513) { // the end instruction
+        info.instruction = Instruction::END;
+        return info;
+    }
+    const DecodeEntry& entry = kDecodeTable[DecodeIndex(instruction)];
+    if ((GetOpCode(instruction) & 0b11) != 0b11 || entry.instruction == Instruction::ILLEGAL ||
+        (entry.checkFunction7 && (GetFunction7(instruction) & ~0b0100000u) != 0)) {
+        info.instruction = Instruction::ILLEGAL;
+        info.immediate = instruction;
+        return info;
+    }
+    info.instruction = entry.instruction;
+    info.destinationRegister = GetDestinationRegister(instruction);
+    info.register1 = GetRegister1(instruction);
+    info.register2 = GetRegister2(instruction);
+    switch (entry.format) {
+        case ImmediateFormat::none:          info.immediate = 0;                                    break;
+        case ImmediateFormat::signedLower:   info.immediate = GetSignedLowerImmediate(instruction);   break;
+        case ImmediateFormat::unsignedLower: info.immediate = GetUnsignedLowerImmediate(instruction); break;
+        case ImmediateFormat::shiftAmount:   info.immediate = GetShiftAmount(instruction);            break;
+        case ImmediateFormat::store:         info.immediate = GetStoreImmediate(instruction);         break;
+        case ImmediateFormat::branch:        info.immediate = GetBranchImmediate(instruction);        break;
+        case ImmediateFormat::upper:         info.immediate = GetUpperImmediate(instruction);         break;
+        case ImmediateFormat::jump:          info.immediate = GetJALImmediate(instruction);           break;
     }
     return info;
 }
 
 } // namespace
 
+const InstructionInfo& InstructionUnit::Decode(const Memory& memory, WordType address) {
+    DecodeCacheEntry& entry = decodeCache_[(address >> 2) & (kDecodeCacheSize - 1)];
+    if (entry.valid && entry.address == address) {
+        ++decodeHit_;
+    } else {
+        ++decodeMiss_;
+        entry.valid = true;
+        entry.address = address;
+        entry.info = GetInstructionInfo(memory.ReadInstruction(address));
+    }
+    return entry.info;
+}
+
+bool InstructionUnit::Fuse(const Memory& memory, FetchEntry& fetched) {
+    const InstructionInfo& first = fetched.info;
+    if (first.destinationRegister == 0) return false;
+    if (first.instruction != Instruction::LUI && first.instruction != Instruction::AUIPC &&
+        first.instruction != Instruction::SLLI) return false;
+    WordType address = fetched.address + 4;
+    InstructionInfo second = Decode(memory, address);
+    // the result of the first one is only read by the second one
+    if (second.destinationRegister != first.destinationRegister ||
+        second.register1 != first.destinationRegister) return false;
+    Fusion fusion;
+    if (first.instruction == Instruction::LUI && second.instruction == Instruction::ADDI) {
+        fusion = Fusion::luiAddi;
+        second.instruction = Instruction::LUI;
+        second.immediate += first.immediate;
+    } else if (first.instruction == Instruction::LUI && IsLoad(second.instruction)) {
+        fusion = Fusion::luiLoad;
+        second.register1 = 0;
+        second.immediate += first.immediate;
+    } else if (first.instruction == Instruction::AUIPC && second.instruction == Instruction::JALR) {
+        fusion = Fusion::auipcJalr;
+        second.instruction = Instruction::JAL;
+        second.immediate = ((fetched.address + first.immediate + second.immediate) & ~1u) - address;
+    } else if (first.instruction == Instruction::SLLI && second.instruction == Instruction::SRLI &&
+               second.immediate == first.immediate) {
+        fusion = Fusion::shifts;
+        second.instruction = Instruction::ANDI;
+        second.register1 = first.register1;
+        second.immediate = 0xFFFFFFFFu >> first.immediate;
+    } else {
+        return false;
+    }
+    fetched.info = second;
+    fetched.address = address;
+    fetched.fusion = fusion;
+    return true;
+}
+
 void InstructionUnit::FetchAndPush(Bus& bus) {
     if (stall_) {
-        if (bus.GetReorderBuffer()[dependency_].ready) {
+        if (bus.GetRegisterFile()[dependency_].ready) {
             stall_ = false;
-            PC_ = bus.GetReorderBuffer()[dependency_].value + immediate_;
+            Redirect(stalledJump_, (bus.GetRegisterFile()[dependency_].value + immediate_) & ~1);
         }
         return;
     }
-    if (bus.GetReorderBuffer().Full() || bus.GetLoadStoreBuffer().Full()) return;
-
-    WordType currentInstruction = bus.GetMemory().ReadInstruction(PC_);
-    if (currentInstruction == 0x0ff00513) { // the end instruction
-        ReorderBufferEntry entry;
-        entry.ready = true;
-        entry.type = ReorderType::end;
-        bus.GetReorderBuffer().Add(entry, bus);
-        return;
+    Fetch(bus.GetMemory());
+    for (SizeType i = 0; i < issueWidth_ && !fetchQueue_.Empty(); ++i) {
+        if (bus.GetReorderBuffer().Full() || bus.GetLoadStoreBuffer().Full() ||
+            bus.GetReservationStation().Full(fetchQueue_.Front().info.instruction) ||
+            bus.GetRegisterFile().Full()) return;
+        if (IsBranch(fetchQueue_.Front().info.instruction) &&
+            bus.GetBranchCheckpoints().Full()) return;
+        FetchEntry fetched = fetchQueue_.Front();
+        fetchQueue_.Pop();
+        if (!Issue(fetched, bus)) return;
+    }
+}
+
+void InstructionUnit::Fetch(const Memory& memory) {
+    for (SizeType i = 0; i < fetchWidth_; ++i) {
+        if (fetchStopped_ || fetchQueue_.Full()) return;
+        FetchEntry fetched;
+        fetched.info = Decode(memory, PC_);
+        fetched.address = PC_;
+        if (Fuse(memory, fetched)) PC_ = fetched.address;
+        const InstructionInfo& info = fetched.info;
+        switch (info.instruction) {
+            case Instruction::END:
+            case Instruction::ILLEGAL:
+                fetchStopped_ = true;
+                fetchQueue_.Push(fetched);
+                return;
+            case Instruction::JAL:
+                if (GetStackOperation(info) == StackOperation::push) {
+                    returnAddressStack_.Push(PC_ + 4);
+                }
+                fetchQueue_.Push(fetched);
+                PC_ += static_cast<SignedWordType>(info.immediate);
+                return;
+            case Instruction::JALR: {
+                StackOperation operation = GetStackOperation(info);
+                if (operation == StackOperation::pop || operation == StackOperation::popAndPush) {
+                    fetched.predicted = predictReturns_ &&
+                                        returnAddressStack_.Pop(fetched.predictedTarget);
+                } else {
+                    fetched.predicted = predictJumps_ &&
+                                        targetPredictor_.Predict(PC_, fetched.predictedTarget);
+                }
+                if (operation == StackOperation::push || operation == StackOperation::popAndPush) {
+                    returnAddressStack_.Push(PC_ + 4);
+                }
+                fetched.stack = returnAddressStack_.Save();
+                fetched.history = targetPredictor_.History();
+                fetched.branchHistory = predictor_->Save();
+                fetchQueue_.Push(fetched);
+                if (fetched.predicted) {
+                    targetPredictor_.Speculate(fetched.predictedTarget);
+                    PC_ = fetched.predictedTarget;
+                } else {
+                    fetchStopped_ = true; // until the target is known at issue
+                }
+                return;
+            }
+            case Instruction::BEQ:
+            case Instruction::BNE:
+            case Instruction::BLT:
+            case Instruction::BGE:
+            case Instruction::BLTU:
+            case Instruction::BGEU:
+                fetched.predicted = predictor_->Predict(PC_);
+                fetched.stack = returnAddressStack_.Save();
+                fetched.history = targetPredictor_.History();
+                fetched.branchHistory = predictor_->Save();
+                predictor_->Speculate(PC_, fetched.predicted);
+                fetchQueue_.Push(fetched);
+                if (fetched.predicted) {
+                    PC_ += static_cast<SignedWordType>(info.immediate);
+                    return;
+                }
+                PC_ += 4;
+                break;
+            default:
+                fetchQueue_.Push(fetched);
+                PC_ += 4;
+                break;
+        }
     }
+}
 
-    InstructionInfo info = GetInstructionInfo(currentInstruction);
+void InstructionUnit::Redirect(const FetchEntry& jump, WordType target) {
+    fetchQueue_.Clear();
+    returnAddressStack_.Restore(jump.stack);
+    targetPredictor_.Restore(jump.history);
+    targetPredictor_.Speculate(target);
+    predictor_->Restore(jump.branchHistory);
+    fetchStopped_ = false;
+    PC_ = target;
+}
+
+bool InstructionUnit::Eliminate(const InstructionInfo& info, Bus& bus) {
     switch (info.instruction) {
+        case Instruction::ADDI:
+            if (info.destinationRegister != 0 && info.register1 != 0 && info.immediate != 0) {
+                return false;
+            }
+            break;
+        case Instruction::SLTI:
+        case Instruction::SLTIU:
+        case Instruction::XORI:
+        case Instruction::ORI:
+        case Instruction::ANDI:
+        case Instruction::SLLI:
+        case Instruction::SRLI:
+        case Instruction::SRAI:
+        case Instruction::ADD:
+        case Instruction::SUB:
+        case Instruction::SLL:
+        case Instruction::SLT:
+        case Instruction::SLTU:
+        case Instruction::XOR:
+        case Instruction::SRL:
+        case Instruction::SRA:
+        case Instruction::OR:
+        case Instruction::AND:
+            if (info.destinationRegister != 0) return false;
+            break;
+        default:
+            return false;
+    }
+    ReorderBufferEntry entry;
+    entry.type = ReorderType::registerWrite;
+    entry.ready = true;
+    entry.index = info.destinationRegister;
+    if (entry.index == 0) {
+        // nothing is written
+    } else if (info.register1 == 0) {
+        entry.physical = bus.GetRegisterFile().Rename(entry.index, entry.previous);
+        bus.GetRegisterFile().Write(entry.physical, info.immediate);
+    } else {
+        entry.moved = true;
+        entry.physical = bus.GetRegisterFile().Move(entry.index, info.register1, entry.previous);
+    }
+    bus.GetReorderBuffer().Add(entry);
+    ++eliminated_;
+    return true;
+}
+
+bool InstructionUnit::Issue(const FetchEntry& fetched, Bus& bus) {
+    const InstructionInfo& info = fetched.info;
+    BranchMask branchMask = bus.GetBranchCheckpoints().Active();
+    ++issued_;
+    ++fused_[static_cast<SizeType>(fetched.fusion)];
+    if (Eliminate(info, bus)) return true;
+    switch (info.instruction) {
+        case Instruction::END: { // End of Main
+            ReorderBufferEntry entry;
+            entry.ready = true;
+            entry.type = ReorderType::end;
+            bus.GetReorderBuffer().Add(entry);
+            return false;
+        }
+        case Instruction::ILLEGAL: { // reported only if it is committed
+            ReorderBufferEntry entry;
+            entry.ready = true;
+            entry.type = ReorderType::illegal;
+            entry.value = info.immediate;
+            entry.address = fetched.address;
+            bus.GetReorderBuffer().Add(entry);
+            return false;
+        }
         case Instruction::LUI: { // Load Upper Immediate
             ReorderBufferEntry entry;
             entry.type = ReorderType::registerWrite;
             entry.ready = true;
             entry.value = info.immediate;
             entry.index = info.destinationRegister;
-            bus.GetReorderBuffer().Add(entry, bus);
-            PC_ += 4;
-            break;
+            entry.physical = bus.GetRegisterFile().Rename(entry.index, entry.previous);
+            bus.GetRegisterFile().Write(entry.physical, entry.value);
+            bus.GetReorderBuffer().Add(entry);
+            return true;
         }
         case Instruction::AUIPC: { // Add Upper Immediate to PC
             ReorderBufferEntry entry;
             entry.type = ReorderType::registerWrite;
             entry.ready = true;
-            entry.value = info.immediate + PC_;
+            entry.value = info.immediate + fetched.address;
             entry.index = info.destinationRegister;
-            bus.GetReorderBuffer().Add(entry, bus);
-            PC_ += 4;
-            break;
+            entry.physical = bus.GetRegisterFile().Rename(entry.index, entry.previous);
+            bus.GetRegisterFile().Write(entry.physical, entry.value);
+            bus.GetReorderBuffer().Add(entry);
+            return true;
         }
         case Instruction::JAL: { // Jump and Link
             ReorderBufferEntry entry;
             entry.type = ReorderType::registerWrite;
             entry.ready = true;
-            entry.value = PC_ + 4;
+            entry.value = fetched.address + 4;
             entry.index = info.destinationRegister;
-            bus.GetReorderBuffer().Add(entry, bus);
-            PC_ += static_cast<SignedWordType>(info.immediate);
-            break;
+            entry.stackOperation = GetStackOperation(info);
+            entry.physical = bus.GetRegisterFile().Rename(entry.index, entry.previous);
+            bus.GetRegisterFile().Write(entry.physical, entry.value);
+            bus.GetReorderBuffer().Add(entry);
+            return true;
         }
         case Instruction::JALR: { // Jump and Link Register
+            // the target is computed again from the committed base register
+            // at commit, where the predictors are checked and trained
             ReorderBufferEntry entry;
-            entry.type = ReorderType::registerWrite;
+            entry.type = ReorderType::jump;
             entry.ready = true;
-            entry.value = PC_ + 4;
+            entry.value = fetched.address + 4;
             entry.index = info.destinationRegister;
-            bus.GetReorderBuffer().Add(entry, bus);
-            if (!bus.GetRegisterFile().Dirty(info.register1)) {
-                PC_ = ((bus.GetRegisterFile().Read(info.register1) + static_cast<SignedWordType>(info.immediate))) & ~1;
-            } else if (bus.GetReorderBuffer()[bus.GetRegisterFile().Dependency(info.register1)].ready) {
-                PC_ = ((bus.GetReorderBuffer()[bus.GetRegisterFile().Dependency(info.register1)].value +
-                        static_cast<SignedWordType>(info.immediate))) & ~1;
+            entry.address = fetched.address;
+            entry.baseRegister = info.register1;
+            entry.offset = info.immediate;
+            entry.stackOperation = GetStackOperation(info);
+            // read the base before the destination register is renamed
+            SizeType dependency = bus.GetRegisterFile().Map(info.register1);
+            bool resolved = true;
+            WordType target = 0;
+            if (bus.GetRegisterFile()[dependency].ready) {
+                target = ((bus.GetRegisterFile()[dependency].value +
+                           static_cast<SignedWordType>(info.immediate))) & ~1;
             } else {
-                stall_ = true;
-                immediate_ = static_cast<SignedWordType>(info.immediate);
-                dependency_ = bus.GetRegisterFile().Dependency(info.register1);
+                resolved = false;
             }
-            break;
+            if (!resolved && fetched.predicted) {
+                // check the predicted target at commit
+                entry.predictedAnswer = true;
+                entry.predictedTarget = fetched.predictedTarget;
+            }
+            entry.physical = bus.GetRegisterFile().Rename(entry.index, entry.previous);
+            bus.GetRegisterFile().Write(entry.physical, entry.value);
+            bus.GetReorderBuffer().Add(entry);
+            if (resolved) {
+                if (fetched.predicted && fetched.predictedTarget == target) return true;
+                // the fetch went the wrong way, or stopped for the target
+                Redirect(fetched, target);
+                return false;
+            }
+            if (fetched.predicted) return true;
+            stall_ = true;
+            immediate_ = static_cast<SignedWordType>(info.immediate);
+            dependency_ = dependency;
+            stalledJump_ = fetched;
+            return false;
         }
         case Instruction::BEQ: // Branch on Equal
         case Instruction::BNE: // Branch on Not Equal
@@ -362,40 +563,38 @@ void InstructionUnit::FetchAndPush(Bus& bus) {
             entry.ready = false;
             RSEntry rsEntry;
             rsEntry.instruction = info.instruction;
-            if (bus.GetRegisterFile().Dirty(info.register1)) {
-                rsEntry.Q1 = bus.GetRegisterFile().Dependency(info.register1);
-                if (bus.GetReorderBuffer()[rsEntry.Q1].ready) {
-                    rsEntry.Value1 = bus.GetReorderBuffer()[rsEntry.Q1].value;
-                } else {
-                    rsEntry.Q1Constraint = true;
-                    rsEntry.busy = true;
-                }
+            rsEntry.Q1 = bus.GetRegisterFile().Map(info.register1);
+            if (bus.GetRegisterFile()[rsEntry.Q1].ready) {
+                rsEntry.Value1 = bus.GetRegisterFile()[rsEntry.Q1].value;
             } else {
-                rsEntry.Value1 = bus.GetRegisterFile().Read(info.register1);
+                rsEntry.Q1Constraint = true;
+                rsEntry.busy = true;
             }
-            if (bus.GetRegisterFile().Dirty(info.register2)) {
-                rsEntry.Q2 = bus.GetRegisterFile().Dependency(info.register2);
-                if (bus.GetReorderBuffer()[rsEntry.Q2].ready) {
-                    rsEntry.Value2 = bus.GetReorderBuffer()[rsEntry.Q2].value;
-                } else {
-                    rsEntry.Q2Constraint = true;
-                    rsEntry.busy = true;
-                }
+            rsEntry.Q2 = bus.GetRegisterFile().Map(info.register2);
+            if (bus.GetRegisterFile()[rsEntry.Q2].ready) {
+                rsEntry.Value2 = bus.GetRegisterFile()[rsEntry.Q2].value;
             } else {
-                rsEntry.Value2 = bus.GetRegisterFile().Read(info.register2);
+                rsEntry.Q2Constraint = true;
+                rsEntry.busy = true;
             }
-            entry.predictedAnswer = predictor_.Predict(PC_);
-            entry.address = PC_;
+            entry.predictedAnswer = fetched.predicted;
+            entry.address = fetched.address;
             if (entry.predictedAnswer) {
-                entry.index = PC_ + 4;
-                PC_ += static_cast<SignedWordType>(info.immediate);
+                entry.index = fetched.address + 4;
             } else {
-                entry.index = PC_ + static_cast<SignedWordType>(info.immediate);
-                PC_ += 4;
+                entry.index = fetched.address + static_cast<SignedWordType>(info.immediate);
             }
-            rsEntry.RoBIndex = bus.GetReorderBuffer().Add(entry, bus);
+            BranchCheckpoint checkpoint;
+            checkpoint.registers = bus.GetRegisterFile().Save();
+            checkpoint.stack = fetched.stack;
+            checkpoint.history = fetched.history;
+            checkpoint.branchHistory = fetched.branchHistory;
+            checkpoint.olderBranches = branchMask;
+            entry.checkpoint = bus.GetBranchCheckpoints().Allocate(checkpoint);
+            rsEntry.branchMask = branchMask;
+            rsEntry.RoBIndex = bus.GetReorderBuffer().Add(entry);
             bus.GetReservationStation().Add(rsEntry);
-            break;
+            return true;
         }
         case Instruction::LB: // Load Byte
         case Instruction::LH: // Load Halfword
@@ -410,21 +609,19 @@ void InstructionUnit::FetchAndPush(Bus& bus) {
             lsEntry.type = info.instruction;
             lsEntry.offset = static_cast<SignedWordType>(info.immediate);
             lsEntry.ready = true;
-            if (bus.GetRegisterFile().Dirty(info.register1)) {
-                lsEntry.baseConstraintIndex = bus.GetRegisterFile().Dependency(info.register1);
-                if (bus.GetReorderBuffer()[lsEntry.baseConstraintIndex].ready) {
-                    lsEntry.base = bus.GetReorderBuffer()[lsEntry.baseConstraintIndex].value;
-                } else {
-                    lsEntry.baseConstraint = true;
-                    lsEntry.ready = false;
-                }
+            lsEntry.baseConstraintIndex = bus.GetRegisterFile().Map(info.register1);
+            if (bus.GetRegisterFile()[lsEntry.baseConstraintIndex].ready) {
+                lsEntry.base = bus.GetRegisterFile()[lsEntry.baseConstraintIndex].value;
             } else {
-                lsEntry.base = bus.GetRegisterFile().Read(info.register1);
+                lsEntry.baseConstraint = true;
+                lsEntry.ready = false;
             }
-            lsEntry.RoBIndex = bus.GetReorderBuffer().Add(entry, bus);
+            lsEntry.branchMask = branchMask;
+            entry.physical = bus.GetRegisterFile().Rename(entry.index, entry.previous);
+            lsEntry.destination = entry.physical;
+            lsEntry.RoBIndex = bus.GetReorderBuffer().Add(entry);
             bus.GetLoadStoreBuffer().Add(lsEntry);
-            PC_ += 4;
-            break;
+            return true;
         }
         case Instruction::SB: // Store Byte
         case Instruction::SH: // Store Halfword
@@ -435,31 +632,23 @@ void InstructionUnit::FetchAndPush(Bus& bus) {
             LoadStoreEntry lsEntry;
             lsEntry.type = info.instruction;
             lsEntry.offset = static_cast<SignedWordType>(info.immediate);
-            if (bus.GetRegisterFile().Dirty(info.register1)) {
-                lsEntry.baseConstraintIndex = bus.GetRegisterFile().Dependency(info.register1);
-                if (bus.GetReorderBuffer()[lsEntry.baseConstraintIndex].ready) {
-                    lsEntry.base = bus.GetReorderBuffer()[lsEntry.baseConstraintIndex].value;
-                } else {
-                    lsEntry.baseConstraint = true;
-                }
+            lsEntry.baseConstraintIndex = bus.GetRegisterFile().Map(info.register1);
+            if (bus.GetRegisterFile()[lsEntry.baseConstraintIndex].ready) {
+                lsEntry.base = bus.GetRegisterFile()[lsEntry.baseConstraintIndex].value;
             } else {
-                lsEntry.base = bus.GetRegisterFile().Read(info.register1);
+                lsEntry.baseConstraint = true;
             }
-            if (bus.GetRegisterFile().Dirty(info.register2)) {
-                lsEntry.valueConstraintIndex = bus.GetRegisterFile().Dependency(info.register2);
-                if (bus.GetReorderBuffer()[lsEntry.valueConstraintIndex].ready) {
-                    lsEntry.value = bus.GetReorderBuffer()[lsEntry.valueConstraintIndex].value;
-                } else {
-                    lsEntry.valueConstraint = true;
-                }
+            lsEntry.valueConstraintIndex = bus.GetRegisterFile().Map(info.register2);
+            if (bus.GetRegisterFile()[lsEntry.valueConstraintIndex].ready) {
+                lsEntry.value = bus.GetRegisterFile()[lsEntry.valueConstraintIndex].value;
             } else {
-                lsEntry.value = bus.GetRegisterFile().Read(info.register2);
+                lsEntry.valueConstraint = true;
             }
             entry.index = bus.GetLoadStoreBuffer().GetEndIndex();
-            lsEntry.RoBIndex = bus.GetReorderBuffer().Add(entry, bus);
+            lsEntry.branchMask = branchMask;
+            lsEntry.RoBIndex = bus.GetReorderBuffer().Add(entry);
             bus.GetLoadStoreBuffer().Add(lsEntry);
-            PC_ += 4;
-            break;
+            return true;
         }
         case Instruction::ADDI: { // Add Immediate
             ReorderBufferEntry entry;
@@ -468,22 +657,20 @@ void InstructionUnit::FetchAndPush(Bus& bus) {
             entry.index = info.destinationRegister;
             RSEntry rsEntry;
             rsEntry.instruction = info.instruction;
-            if (bus.GetRegisterFile().Dirty(info.register1)) {
-                rsEntry.Q1 = bus.GetRegisterFile().Dependency(info.register1);
-                if (bus.GetReorderBuffer()[rsEntry.Q1].ready) {
-                    rsEntry.Value1 = bus.GetReorderBuffer()[rsEntry.Q1].value;
-                } else {
-                    rsEntry.Q1Constraint = true;
-                    rsEntry.busy = true;
-                }
+            rsEntry.Q1 = bus.GetRegisterFile().Map(info.register1);
+            if (bus.GetRegisterFile()[rsEntry.Q1].ready) {
+                rsEntry.Value1 = bus.GetRegisterFile()[rsEntry.Q1].value;
             } else {
-                rsEntry.Value1 = bus.GetRegisterFile().Read(info.register1);
+                rsEntry.Q1Constraint = true;
+                rsEntry.busy = true;
             }
             rsEntry.Value2 = info.immediate;
-            rsEntry.RoBIndex = bus.GetReorderBuffer().Add(entry, bus);
+            rsEntry.branchMask = branchMask;
+            entry.physical = bus.GetRegisterFile().Rename(entry.index, entry.previous);
+            rsEntry.destination = entry.physical;
+            rsEntry.RoBIndex = bus.GetReorderBuffer().Add(entry);
             bus.GetReservationStation().Add(rsEntry);
-            PC_ += 4;
-            break;
+            return true;
         }
         case Instruction::SLTI: // Set Less Than Immediate
         case Instruction::SLTIU: // Set Less Than Immediate Unsigned
@@ -499,22 +686,20 @@ void InstructionUnit::FetchAndPush(Bus& bus) {
             entry.index = info.destinationRegister;
             RSEntry rsEntry;
             rsEntry.instruction = info.instruction;
-            if (bus.GetRegisterFile().Dirty(info.register1)) {
-                rsEntry.Q1 = bus.GetRegisterFile().Dependency(info.register1);
-                if (bus.GetReorderBuffer()[rsEntry.Q1].ready) {
-                    rsEntry.Value1 = bus.GetReorderBuffer()[rsEntry.Q1].value;
-                } else {
-                    rsEntry.Q1Constraint = true;
-                    rsEntry.busy = true;
-                }
+            rsEntry.Q1 = bus.GetRegisterFile().Map(info.register1);
+            if (bus.GetRegisterFile()[rsEntry.Q1].ready) {
+                rsEntry.Value1 = bus.GetRegisterFile()[rsEntry.Q1].value;
             } else {
-                rsEntry.Value1 = bus.GetRegisterFile().Read(info.register1);
+                rsEntry.Q1Constraint = true;
+                rsEntry.busy = true;
             }
             rsEntry.Value2 = info.immediate;
-            rsEntry.RoBIndex = bus.GetReorderBuffer().Add(entry, bus);
+            rsEntry.branchMask = branchMask;
+            entry.physical = bus.GetRegisterFile().Rename(entry.index, entry.previous);
+            rsEntry.destination = entry.physical;
+            rsEntry.RoBIndex = bus.GetReorderBuffer().Add(entry);
             bus.GetReservationStation().Add(rsEntry);
-            PC_ += 4;
-            break;
+            return true;
         }
         case Instruction::ADD: // Add
         case Instruction::SUB: // Subtract
@@ -532,44 +717,93 @@ void InstructionUnit::FetchAndPush(Bus& bus) {
             entry.index = info.destinationRegister;
             RSEntry rsEntry;
             rsEntry.instruction = info.instruction;
-            if (bus.GetRegisterFile().Dirty(info.register1)) {
-                rsEntry.Q1 = bus.GetRegisterFile().Dependency(info.register1);
-                if (bus.GetReorderBuffer()[rsEntry.Q1].ready) {
-                    rsEntry.Value1 = bus.GetReorderBuffer()[rsEntry.Q1].value;
-                } else {
-                    rsEntry.Q1Constraint = true;
-                    rsEntry.busy = true;
-                }
+            rsEntry.Q1 = bus.GetRegisterFile().Map(info.register1);
+            if (bus.GetRegisterFile()[rsEntry.Q1].ready) {
+                rsEntry.Value1 = bus.GetRegisterFile()[rsEntry.Q1].value;
             } else {
-                rsEntry.Value1 = bus.GetRegisterFile().Read(info.register1);
+                rsEntry.Q1Constraint = true;
+                rsEntry.busy = true;
             }
-            if (bus.GetRegisterFile().Dirty(info.register2)) {
-                rsEntry.Q2 = bus.GetRegisterFile().Dependency(info.register2);
-                if (bus.GetReorderBuffer()[rsEntry.Q2].ready) {
-                    rsEntry.Value2 = bus.GetReorderBuffer()[rsEntry.Q2].value;
-                } else {
-                    rsEntry.Q2Constraint = true;
-                    rsEntry.busy = true;
-                }
+            rsEntry.Q2 = bus.GetRegisterFile().Map(info.register2);
+            if (bus.GetRegisterFile()[rsEntry.Q2].ready) {
+                rsEntry.Value2 = bus.GetRegisterFile()[rsEntry.Q2].value;
             } else {
-                rsEntry.Value2 = bus.GetRegisterFile().Read(info.register2);
+                rsEntry.Q2Constraint = true;
+                rsEntry.busy = true;
             }
-            rsEntry.RoBIndex = bus.GetReorderBuffer().Add(entry, bus);
+            rsEntry.branchMask = branchMask;
+            entry.physical = bus.GetRegisterFile().Rename(entry.index, entry.previous);
+            rsEntry.destination = entry.physical;
+            rsEntry.RoBIndex = bus.GetReorderBuffer().Add(entry);
             bus.GetReservationStation().Add(rsEntry);
-            PC_ += 4;
-            break;
+            return true;
         }
         default:
             assert(false);
+            return false;
     }
 }
 
 void InstructionUnit::SetPC(WordType pc) { PC_ = pc; }
 
-void InstructionUnit::ResetStateOnClearPipeline() { stall_ = false; }
+void InstructionUnit::ResetStateOnClearPipeline() {
+    stall_ = false;
+    fetchStopped_ = false;
+    fetchQueue_.Clear();
+    returnAddressStack_.Restore();
+    targetPredictor_.Restore();
+    predictor_->Restore();
+}
+
+void InstructionUnit::Recover(const BranchCheckpoint& checkpoint, WordType address, bool answer,
+                              WordType pc) {
+    stall_ = false; // a stalled JALR is younger than the branch
+    fetchStopped_ = false;
+    fetchQueue_.Clear();
+    returnAddressStack_.Restore(checkpoint.stack);
+    targetPredictor_.Restore(checkpoint.history);
+    predictor_->Restore(checkpoint.branchHistory);
+    predictor_->Speculate(address, answer);
+    PC_ = pc;
+}
 
-Predictor& InstructionUnit::GetPredictor() { return predictor_; }
+Predictor& InstructionUnit::GetPredictor() { return *predictor_; }
+
+ReturnAddressStack& InstructionUnit::GetReturnAddressStack() { return returnAddressStack_; }
+
+TargetPredictor& InstructionUnit::GetTargetPredictor() { return targetPredictor_; }
 
 float InstructionUnit::PredictorAccuracy() const {
-    return predictor_.GetAccuracy();
+    return predictor_->GetAccuracy();
+}
+
+void InstructionUnit::InvalidateDecoded(WordType address, SizeType size) {
+    for (WordType line = address & ~3u; line < address + size; line += 4) {
+        DecodeCacheEntry& entry = decodeCache_[(line >> 2) & (kDecodeCacheSize - 1)];
+        if (entry.address == line) entry.valid = false;
+    }
+}
+
+SizeType InstructionUnit::Eliminated() const { return eliminated_; }
+
+void InstructionUnit::PrintFusionStatistics(std::ostream& out) const {
+    SizeType pairs = issued_ - fused_[static_cast<SizeType>(Fusion::none)];
+    out << "Fused pairs: "
+        << fused_[static_cast<SizeType>(Fusion::luiAddi)] << " lui+addi, "
+        << fused_[static_cast<SizeType>(Fusion::auipcJalr)] << " auipc+jalr, "
+        << fused_[static_cast<SizeType>(Fusion::luiLoad)] << " lui+load, "
+        << fused_[static_cast<SizeType>(Fusion::shifts)] << " slli+srli";
+    if (issued_ > 0) {
+        out << " (" << std::fixed << std::setprecision(2)
+            << 200.0 * pairs / static_cast<double>(issued_ + pairs)
+            << "% of the instructions issued)";
+    }
+    out << "." << std::endl;
+}
+
+float InstructionUnit::DecodeCacheHitRate() const {
+    if (decodeHit_ + decodeMiss_ == 0) {
+        return NAN;
+    }
+    return static_cast<float>(decodeHit_) / static_cast<float>(decodeHit_ + decodeMiss_);
 }
@@ -25,12 +25,19 @@
 #include "register.h"
 #include "reorder_buffer.h"
 
+LoadStoreBuffer::LoadStoreBuffer(const Config& config)
+    : consumers_(config.physicalRegisters) {}
+
 bool LoadStoreBuffer::Full() const {
     return buffer_.Full();
 }
 
 void LoadStoreBuffer::Add(const LoadStoreEntry& entry) {
     buffer_.Push(entry);
+    SizeType index = buffer_.TailIndex();
+    if (entry.baseConstraint) consumers_[entry.baseConstraintIndex].Set(index);
+    if (entry.valueConstraint) consumers_[entry.valueConstraintIndex].Set(index);
+    if (!entry.baseConstraint && !entry.valueConstraint) settled_.Set(index);
 }
 
 void LoadStoreBuffer::Execute(Bus& bus) {
@@ -43,31 +50,49 @@ void LoadStoreBuffer::Execute(Bus& bus) {
     } else if (!buffer_.Empty() && buffer_.Front().ready) {
         count_ = 2;
     }
-    this->UpdateBusyState(bus.GetReorderBuffer());
+    this->UpdateBusyState(bus.GetReorderBuffer(), bus.GetRegisterFile());
 }
 
-void LoadStoreBuffer::UpdateBusyState(ReorderBuffer& reorderBuffer) {
-    for (auto& entry : buffer_) {
-        if (entry.baseConstraint && reorderBuffer.GetEntry(entry.baseConstraintIndex).ready) {
-            entry.base = reorderBuffer.GetEntry(entry.baseConstraintIndex).value;
-            entry.baseConstraint = false;
-        }
-        if (entry.type == Instruction::SW || entry.type == Instruction::SH ||
-            entry.type == Instruction::SB) {
-            if (entry.valueConstraint && reorderBuffer.GetEntry(entry.valueConstraintIndex).ready) {
-                entry.value = reorderBuffer.GetEntry(entry.valueConstraintIndex).value;
-                entry.valueConstraint = false;
+void LoadStoreBuffer::UpdateBusyState(ReorderBuffer& reorderBuffer,
+                                      const RegisterFile& registerFile) {
+    for (SizeType physical : registerFile.Broadcast()) {
+        const PhysicalRegister& source = registerFile[physical];
+        // renamed again after a squashed instruction wrote it
+        if (!source.ready) continue;
+        consumers_[physical].ForEach([&](SizeType i) {
+            // the squashed entries are left behind
+            if (!InUse(i)) return;
+            LoadStoreEntry& entry = buffer_[i];
+            if (entry.baseConstraint && entry.baseConstraintIndex == physical) {
+                entry.base = source.value;
+                entry.baseConstraint = false;
             }
-            if (!entry.ready && !entry.baseConstraint && !entry.valueConstraint) {
-                // entry.ready is used to avoid the case that the entry will be updated again.
-                reorderBuffer.WriteEntry(entry.RoBIndex).ready = true;
+            if (entry.valueConstraint && entry.valueConstraintIndex == physical) {
+                entry.value = source.value;
+                entry.valueConstraint = false;
             }
+            if (!entry.baseConstraint && !entry.valueConstraint) settled_.Set(i);
+        });
+        consumers_[physical].Clear();
+    }
+    settled_.ForEach([&](SizeType i) {
+        if (!InUse(i)) return;
+        LoadStoreEntry& entry = buffer_[i];
+        if (entry.type == Instruction::SW || entry.type == Instruction::SH ||
+            entry.type == Instruction::SB) {
+            // a store is ready when it is committed
+            if (!entry.ready) reorderBuffer.WriteEntry(entry.RoBIndex).ready = true;
         } else { // Load
-            if (!entry.baseConstraint && !entry.valueConstraint) {
-                entry.ready = true;
-            }
+            entry.ready = true;
         }
-    }
+    });
+    settled_.Clear();
+}
+
+bool LoadStoreBuffer::InUse(SizeType index) const {
+    SizeType capacity = buffer_.Capacity();
+    return (index + capacity - buffer_.HeadIndex()) % capacity <
+           (GetEndIndex() + capacity - buffer_.HeadIndex()) % capacity;
 }
 
 LoadStoreEntry& LoadStoreBuffer::operator[](SizeType index) {
@@ -77,28 +102,28 @@ LoadStoreEntry& LoadStoreBuffer::operator[](SizeType index) {
 void LoadStoreBuffer::MemoryIO(Bus& bus) {
     switch (buffer_.Front().type) {
         case Instruction::LW:
-            bus.GetReorderBuffer()[buffer_.Front().RoBIndex].value =
-                bus.GetMemory().ReadWord(buffer_.Front().base + buffer_.Front().offset);
+            bus.GetRegisterFile().Write(buffer_.Front().destination, bus.GetMemory().ReadWord(
+                buffer_.Front().base + buffer_.Front().offset));
             bus.GetReorderBuffer()[buffer_.Front().RoBIndex].ready = true;
             break;
         case Instruction::LH:
-            bus.GetReorderBuffer()[buffer_.Front().RoBIndex].value =
-                bus.GetMemory().ReadSignedHalfWord(buffer_.Front().base + buffer_.Front().offset);
+            bus.GetRegisterFile().Write(buffer_.Front().destination, bus.GetMemory().ReadSignedHalfWord(
+                buffer_.Front().base + buffer_.Front().offset));
             bus.GetReorderBuffer()[buffer_.Front().RoBIndex].ready = true;
             break;
         case Instruction::LHU:
-            bus.GetReorderBuffer()[buffer_.Front().RoBIndex].value =
-                bus.GetMemory().ReadHalfWord(buffer_.Front().base + buffer_.Front().offset);
+            bus.GetRegisterFile().Write(buffer_.Front().destination, bus.GetMemory().ReadHalfWord(
+                buffer_.Front().base + buffer_.Front().offset));
             bus.GetReorderBuffer()[buffer_.Front().RoBIndex].ready = true;
             break;
         case Instruction::LB:
-            bus.GetReorderBuffer()[buffer_.Front().RoBIndex].value =
-                bus.GetMemory().ReadSignedByte(buffer_.Front().base + buffer_.Front().offset);
+            bus.GetRegisterFile().Write(buffer_.Front().destination, bus.GetMemory().ReadSignedByte(
+                buffer_.Front().base + buffer_.Front().offset));
             bus.GetReorderBuffer()[buffer_.Front().RoBIndex].ready = true;
             break;
         case Instruction::LBU:
-            bus.GetReorderBuffer()[buffer_.Front().RoBIndex].value =
-                bus.GetMemory().ReadByte(buffer_.Front().base + buffer_.Front().offset);
+            bus.GetRegisterFile().Write(buffer_.Front().destination, bus.GetMemory().ReadByte(
+                buffer_.Front().base + buffer_.Front().offset));
             bus.GetReorderBuffer()[buffer_.Front().RoBIndex].ready = true;
             break;
         case Instruction::SW:
@@ -109,14 +134,17 @@ void LoadStoreBuffer::MemoryIO(Bus& bus) {
                       << buffer_.Front().base + buffer_.Front().offset << " "
                       << buffer_.Front().value << std::endl;
 #endif
+            bus.InvalidateDecoded(buffer_.Front().base + buffer_.Front().offset, 4);
             break;
         case Instruction::SH:
             bus.GetMemory().StoreHalfWord(buffer_.Front().base + buffer_.Front().offset,
                                           static_cast<HalfWordType>(buffer_.Front().value));
+            bus.InvalidateDecoded(buffer_.Front().base + buffer_.Front().offset, 2);
             break;
         case Instruction::SB:
             bus.GetMemory().StoreByte(buffer_.Front().base + buffer_.Front().offset,
                                       static_cast<ByteType>(buffer_.Front().value));
+            bus.InvalidateDecoded(buffer_.Front().base + buffer_.Front().offset, 1);
             break;
         default:
             assert(false);
@@ -140,6 +168,24 @@ void LoadStoreBuffer::ClearOnWrongPrediction() {
 
 }
 
+void LoadStoreBuffer::Squash(BranchMask branch) {
+    // the entries are in program order
+    SizeType tail = (buffer_.TailIndex() + 1) % buffer_.Capacity();
+    for (SizeType i = buffer_.HeadIndex(); i != tail; i = (i + 1) % buffer_.Capacity()) {
+        if (buffer_[i].branchMask & branch) {
+            buffer_.SetAsEnd(i);
+            break;
+        }
+    }
+    if (buffer_.Empty()) {
+        count_ = 0;
+    }
+}
+
+void LoadStoreBuffer::ResolveBranches(BranchMask branches) {
+    for (auto& entry : buffer_) entry.branchMask &= ~branches;
+}
+
 SizeType LoadStoreBuffer::GetEndIndex() const {
     return (buffer_.TailIndex() + 1) % buffer_.Capacity();
 }
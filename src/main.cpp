@@ -14,10 +14,251 @@
 // You should have received a copy of the GNU General Public License
 // along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <memory>
+
 #include "bus.h"
+#include "config.h"
+#include "image.h"
+
+namespace {
+
+void PrintUsage(const char* name) {
+    std::cerr << "Usage: " << name << " [options]\n"
+              << "Run the Verilog hex image on stdin by default.\n"
+              << "  --image <file>               run a binary image or an ELF executable\n"
+              << "  --convert <file>             convert the image into a binary image\n"
+              << "  --issue-width <n>            issue up to n instructions per cycle (default 1)\n"
+              << "  --commit-width <n>           commit up to n instructions per cycle (default 1)\n"
+              << "  --fetch-width <n>            fetch up to n instructions per cycle\n"
+              << "                               (default: issue width)\n"
+              << "  --branch-checkpoints <n>     unresolved branches in flight, 1 to 32\n"
+              << "                               (default 8)\n"
+              << "  --physical-registers <n>     physical registers for renaming, more than 32\n"
+              << "                               (default 64)\n"
+              << "  --rs-size <n>                reservation station entries, 1 to 256\n"
+              << "                               (default 32)\n"
+              << "  --rs-queues <a>,<s>,<c>,<l>  split the reservation station into queues of\n"
+              << "                               a, s, c and l entries for the adders, the\n"
+              << "                               shifters, the comparers and the logic units,\n"
+              << "                               256 in total at most\n"
+              << "  --select <policy>            start the ready entries of the reservation\n"
+              << "                               station from the lowest index or the oldest\n"
+              << "                               instruction: index or oldest (default index)\n"
+              << "  --latency <ops>=<l>[/<i>]    run the comma-separated ALU instructions, such\n"
+              << "                               as add,addi, in l cycles, starting one every\n"
+              << "                               i cycles, 1 <= i <= l <= 16 (default 1/1)\n"
+              << "  --predictor <name>           local, bimodal, gshare, tournament, tage or\n"
+              << "                               perceptron (default local)\n"
+              << "  --perceptron-history <n>     global history of the perceptrons, 1 to 64\n"
+              << "                               (default 32)\n"
+              << "  --perceptron-weight-bits <n> weight width of the perceptrons, 2 to 16\n"
+              << "                               (default 8)\n"
+              << "  --no-ras                     do not predict the returns, but wait for their\n"
+              << "                               targets\n"
+              << "  --no-target-predictor        do not predict the other indirect jumps, but\n"
+              << "                               wait for their targets\n"
+              << "  --branch-stats               print the accuracy of each branch at the end\n";
+}
+
+/**
+ * Parse a positive number.
+ * @return false if the text is not a positive number
+ */
+bool ParseSize(const char* text, SizeType& value) {
+    char* end = nullptr;
+    unsigned long result = std::strtoul(text, &end, 10);
+    if (*text == '\0' || *end != '\0' || result == 0 || result > 0xFFFFFFFFul) return false;
+    value = static_cast<SizeType>(result);
+    return true;
+}
+
+/**
+ * Parse the name of a branch predictor.
+ * @return false if there is no such predictor
+ */
+bool ParsePredictor(const char* text, PredictorType& type) {
+    const std::pair<const char*, PredictorType> kPredictors[] = {
+        {"local",      PredictorType::local},
+        {"bimodal",    PredictorType::bimodal},
+        {"gshare",     PredictorType::gshare},
+        {"tournament", PredictorType::tournament},
+        {"tage",       PredictorType::tage},
+        {"perceptron", PredictorType::perceptron},
+    };
+    for (const auto& [name, value] : kPredictors) {
+        if (std::strcmp(text, name) == 0) {
+            type = value;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Parse the entries of the four reservation queues, separated by commas.
+ * @return false if they are not four positive numbers within the entries of
+ * the reservation station in total
+ */
+bool ParseQueues(const char* text, SizeType (&sizes)[4]) {
+    SizeType total = 0;
+    for (SizeType i = 0; i < 4; ++i) {
+        char* end = nullptr;
+        unsigned long result = std::strtoul(text, &end, 10);
+        if (end == text || *end != (i + 1 < 4 ? ',' : '\0') || result == 0 ||
+            result > ReservationStation::kMaxEntries) return false;
+        sizes[i] = static_cast<SizeType>(result);
+        total += sizes[i];
+        text = end + 1;
+    }
+    return total <= ReservationStation::kMaxEntries;
+}
+
+/**
+ * Parse the timings of some ALU instructions, as in "add,addi=3/1".
+ * @return false if there is no such instruction, the timing is out of range, or
+ *         the interval is longer than the latency
+ */
+bool ParseTiming(const char* text, std::map<Instruction, Timing>& timings) {
+    const std::pair<const char*, Instruction> kInstructions[] = {
+        {"beq",  Instruction::BEQ},  {"bne",   Instruction::BNE},
+        {"blt",  Instruction::BLT},  {"bge",   Instruction::BGE},
+        {"bltu", Instruction::BLTU}, {"bgeu",  Instruction::BGEU},
+        {"addi", Instruction::ADDI}, {"slti",  Instruction::SLTI},
+        {"ori",  Instruction::ORI},  {"sltiu", Instruction::SLTIU},
+        {"xori", Instruction::XORI}, {"andi",  Instruction::ANDI},
+        {"slli", Instruction::SLLI}, {"srli",  Instruction::SRLI},
+        {"srai", Instruction::SRAI}, {"add",   Instruction::ADD},
+        {"sub",  Instruction::SUB},  {"sll",   Instruction::SLL},
+        {"slt",  Instruction::SLT},  {"sltu",  Instruction::SLTU},
+        {"xor",  Instruction::XOR},  {"srl",   Instruction::SRL},
+        {"sra",  Instruction::SRA},  {"or",    Instruction::OR},
+        {"and",  Instruction::AND},
+    };
+    const char* separator = std::strchr(text, '=');
+    if (separator == nullptr) return false;
+    Timing timing;
+    char* end = nullptr;
+    timing.latency = static_cast<SizeType>(std::strtoul(separator + 1, &end, 10));
+    if (*end == '/') timing.interval = static_cast<SizeType>(std::strtoul(end + 1, &end, 10));
+    if (*end != '\0' || timing.latency == 0 || timing.latency > ALU::kMaxLatency ||
+        timing.interval == 0 || timing.interval > timing.latency) return false;
+    std::map<Instruction, Timing> parsed;
+    for (const char* name = text; name <= separator;) {
+        const char* next = name + std::strcspn(name, ",=");
+        bool found = false;
+        for (const auto& [mnemonic, instruction] : kInstructions) {
+            if (std::strlen(mnemonic) == static_cast<std::size_t>(next - name) &&
+                std::strncmp(name, mnemonic, next - name) == 0) {
+                parsed[instruction] = timing;
+                found = true;
+            }
+        }
+        if (!found) return false;
+        name = next + 1;
+    }
+    for (const auto& [instruction, value] : parsed) timings[instruction] = value;
+    return true;
+}
+
+/**
+ * Parse the name of a select policy.
+ * @return false if there is no such policy
+ */
+bool ParseSelect(const char* text, SelectPolicy& policy) {
+    if (std::strcmp(text, "index") == 0) {
+        policy = SelectPolicy::index;
+    } else if (std::strcmp(text, "oldest") == 0) {
+        policy = SelectPolicy::oldest;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    const char* imagePath = nullptr;
+    const char* convertPath = nullptr;
+    Config      config;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--image") == 0 && i + 1 < argc) {
+            imagePath = argv[++i];
+        } else if (std::strcmp(argv[i], "--convert") == 0 && i + 1 < argc) {
+            convertPath = argv[++i];
+        } else if (std::strcmp(argv[i], "--issue-width") == 0 && i + 1 < argc &&
+                   ParseSize(argv[i + 1], config.issueWidth)) {
+            ++i;
+        } else if (std::strcmp(argv[i], "--commit-width") == 0 && i + 1 < argc &&
+                   ParseSize(argv[i + 1], config.commitWidth)) {
+            ++i;
+        } else if (std::strcmp(argv[i], "--branch-checkpoints") == 0 && i + 1 < argc &&
+                   ParseSize(argv[i + 1], config.branchCheckpoints) &&
+                   config.branchCheckpoints <= BranchCheckpoints::kMaxCount) {
+            ++i;
+        } else if (std::strcmp(argv[i], "--physical-registers") == 0 && i + 1 < argc &&
+                   ParseSize(argv[i + 1], config.physicalRegisters) &&
+                   config.physicalRegisters > RegisterFile::kRegisterCount) {
+            ++i;
+        } else if (std::strcmp(argv[i], "--rs-size") == 0 && i + 1 < argc &&
+                   ParseSize(argv[i + 1], config.reservationStationSize) &&
+                   config.reservationStationSize <= ReservationStation::kMaxEntries) {
+            ++i;
+        } else if (std::strcmp(argv[i], "--rs-queues") == 0 && i + 1 < argc &&
+                   ParseQueues(argv[i + 1], config.reservationQueues)) {
+            ++i;
+        } else if (std::strcmp(argv[i], "--select") == 0 && i + 1 < argc &&
+                   ParseSelect(argv[i + 1], config.select)) {
+            ++i;
+        } else if (std::strcmp(argv[i], "--latency") == 0 && i + 1 < argc &&
+                   ParseTiming(argv[i + 1], config.timings)) {
+            ++i;
+        } else if (std::strcmp(argv[i], "--fetch-width") == 0 && i + 1 < argc &&
+                   ParseSize(argv[i + 1], config.fetchWidth)) {
+            ++i;
+        } else if (std::strcmp(argv[i], "--predictor") == 0 && i + 1 < argc &&
+                   ParsePredictor(argv[i + 1], config.predictor.type)) {
+            ++i;
+        } else if (std::strcmp(argv[i], "--perceptron-history") == 0 && i + 1 < argc &&
+                   ParseSize(argv[i + 1], config.predictor.perceptronHistory) &&
+                   config.predictor.perceptronHistory <= PerceptronPredictor::kMaxHistory) {
+            ++i;
+        } else if (std::strcmp(argv[i], "--perceptron-weight-bits") == 0 && i + 1 < argc &&
+                   ParseSize(argv[i + 1], config.predictor.perceptronWeightBits) &&
+                   config.predictor.perceptronWeightBits >= 2 &&
+                   config.predictor.perceptronWeightBits <= 16) {
+            ++i;
+        } else if (std::strcmp(argv[i], "--no-ras") == 0) {
+            config.returnAddressStack = false;
+        } else if (std::strcmp(argv[i], "--no-target-predictor") == 0) {
+            config.targetPredictor = false;
+        } else if (std::strcmp(argv[i], "--branch-stats") == 0) {
+            config.predictor.branchStatistics = true;
+        } else {
+            PrintUsage(argv[0]);
+            return 1;
+        }
+    }
 
-int main() {
-    Bus bus;
+    auto image = std::make_shared<ProgramImage>();
+    if (imagePath != nullptr ? !image->Open(imagePath) : !image->ReadHex(stdin)) {
+        std::cerr << "Cannot load the image "
+                  << (imagePath != nullptr ? imagePath : "on stdin") << "." << std::endl;
+        return 1;
+    }
+    if (convertPath != nullptr) {
+        if (!image->Save(convertPath)) {
+            std::cerr << "Cannot convert the image into " << convertPath << "." << std::endl;
+            return 1;
+        }
+        return 0;
+    }
+    Bus bus(image, config);
     bus.Run();
-    return 0;
+    return bus.ExitCode();
 }
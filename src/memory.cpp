@@ -16,66 +16,179 @@
 
 #include "memory.h"
 
-#include <iostream>
-#include <string>
+#include <algorithm>
+#include <cstring>
+#include <utility>
 
-Memory::Memory(SizeType size) {
-    memory_ = new ByteType[size];
-    Init();
-}
+#include "image.h"
+
+namespace {
+
+constexpr ByteType kZeroPage[Memory::kPageSize] = {0};
+
+} // namespace
 
 Memory::~Memory() {
-    delete[] memory_;
+    for (auto table : directory_) {
+        if (table == nullptr) continue;
+        for (SizeType i = 0; i < kTableSize; ++i) {
+            if (table->owned[i]) delete[] table->pages[i];
+        }
+        delete table;
+    }
+}
+
+const ByteType* Memory::ReadablePage(WordType page) const {
+    const PageTable* table = directory_[page >> kTableBits];
+    const ByteType* data = nullptr;
+    if (table != nullptr) data = table->pages[page & (kTableSize - 1)];
+    readPage_ = page;
+    readData_ = data != nullptr ? data : kZeroPage;
+    return readData_;
+}
+
+ByteType* Memory::WritablePage(WordType page) {
+    PageTable*& table = directory_[page >> kTableBits];
+    if (table == nullptr) table = new PageTable;
+    SizeType entry = page & (kTableSize - 1);
+    if (!table->owned[entry]) {
+        // Allocate the page on the first write, copying the page of the image
+        // if there is one.
+        auto data = new ByteType[kPageSize]();
+        if (table->pages[entry] != nullptr) {
+            std::memcpy(data, table->pages[entry], kPageSize);
+        }
+        table->pages[entry] = data;
+        table->owned[entry] = true;
+        ++pageCount_;
+        if (readPage_ == page) readData_ = data;
+    }
+    writePage_ = page;
+    writeData_ = table->pages[entry];
+    return writeData_;
+}
+
+template<class T>
+T Memory::Read(SizeType index) const {
+    WordType page = index >> kPageBits;
+    SizeType offset = index & (kPageSize - 1);
+    T value;
+    if (offset <= kPageSize - sizeof(T)) {
+        const ByteType* data = page == readPage_ ? readData_ : ReadablePage(page);
+        std::memcpy(&value, data + offset, sizeof(T));
+    } else { // across two pages
+        ByteType bytes[sizeof(T)];
+        for (SizeType i = 0; i < sizeof(T); ++i) {
+            SizeType address = index + i;
+            bytes[i] = ReadablePage(address >> kPageBits)[address & (kPageSize - 1)];
+        }
+        std::memcpy(&value, bytes, sizeof(T));
+    }
+    return value;
+}
+
+template<class T>
+void Memory::Store(SizeType index, T value) {
+    WordType page = index >> kPageBits;
+    SizeType offset = index & (kPageSize - 1);
+    if (offset <= kPageSize - sizeof(T)) {
+        ByteType* data = page == writePage_ ? writeData_ : WritablePage(page);
+        std::memcpy(data + offset, &value, sizeof(T));
+    } else { // across two pages
+        ByteType bytes[sizeof(T)];
+        std::memcpy(bytes, &value, sizeof(T));
+        for (SizeType i = 0; i < sizeof(T); ++i) {
+            SizeType address = index + i;
+            WritablePage(address >> kPageBits)[address & (kPageSize - 1)] = bytes[i];
+        }
+    }
 }
 
 WordType Memory::ReadWord(SizeType index) const {
-    return *(reinterpret_cast<WordType*>(memory_ + index));
+    return Read<WordType>(index);
 }
 
 WordType Memory::ReadHalfWord(SizeType index) const {
-    return static_cast<WordType>(*(reinterpret_cast<HalfWordType*>(memory_ + index)));
+    return static_cast<WordType>(Read<HalfWordType>(index));
 }
 
 WordType Memory::ReadSignedHalfWord(SizeType index) const {
-    return static_cast<WordType>(static_cast<SignedWordType>(
-        *(reinterpret_cast<SignedHalfWordType*>(memory_ + index))));
+    return static_cast<WordType>(static_cast<SignedWordType>(Read<SignedHalfWordType>(index)));
 }
 
 WordType Memory::ReadByte(SizeType index) const {
-    return static_cast<WordType>(*(memory_ + index));
+    return static_cast<WordType>(Read<ByteType>(index));
 }
 
 WordType Memory::ReadSignedByte(SizeType index) const {
-    return static_cast<WordType>(static_cast<SignedWordType>(*(
-        reinterpret_cast<SignedByteType*>(memory_ + index))));
+    return static_cast<WordType>(static_cast<SignedWordType>(Read<SignedByteType>(index)));
 }
 
 void Memory::StoreWord(SizeType index, WordType value) {
-    *(reinterpret_cast<WordType*>(memory_ + index)) = value;
+    Store<WordType>(index, value);
 }
 
 void Memory::StoreHalfWord(SizeType index, HalfWordType value) {
-    *(reinterpret_cast<HalfWordType*>(memory_ + index)) = value;
+    Store<HalfWordType>(index, value);
 }
 
 void Memory::StoreByte(SizeType index, ByteType value) {
-    memory_[index] = value;
-}
-
-void Memory::Init() {
-    std::string token;
-    WordType address = 0;
-while (std::cin >> token) {
-        if (token[0] == '@') {
-            std::string address_str = token.substr(1);
-            address = std::stoi(address_str, nullptr, 16);
-        } else {
-            memory_[address] = static_cast<ByteType>(std::stoi(token, nullptr, 16));
-            ++address;
+    Store<ByteType>(index, value);
+}
+
+void Memory::Copy(WordType address, const ByteType* data, SizeType size) {
+    while (size > 0) {
+        SizeType offset = address & (kPageSize - 1);
+        SizeType chunk = std::min(size, kPageSize - offset);
+        std::memcpy(WritablePage(address >> kPageBits) + offset, data, chunk);
+        address += chunk;
+        data += chunk;
+        size -= chunk;
+    }
+}
+
+void Memory::Zero(WordType address, SizeType size) {
+    while (size > 0) {
+        SizeType offset = address & (kPageSize - 1);
+        SizeType chunk = std::min(size, kPageSize - offset);
+        // A page never written is zero already.
+        if (ReadablePage(address >> kPageBits) != kZeroPage) {
+            std::memset(WritablePage(address >> kPageBits) + offset, 0, chunk);
         }
+        address += chunk;
+        size -= chunk;
     }
 }
 
+void Memory::Load(std::shared_ptr<const ProgramImage> image) {
+    image_ = std::move(image);
+    for (const auto& section : image_->Sections()) {
+        const ByteType* data = image_->Data(section);
+        SizeType shared = 0;
+        if (section.address % kPageSize == 0 && section.offset % kPageSize == 0) {
+            // Use the whole pages of the image in place.
+            shared = section.fileSize / kPageSize * kPageSize;
+            for (SizeType i = 0; i < shared; i += kPageSize) {
+                WordType page = (section.address + i) >> kPageBits;
+                PageTable*& table = directory_[page >> kTableBits];
+                if (table == nullptr) table = new PageTable;
+                SizeType entry = page & (kTableSize - 1);
+                if (table->owned[entry]) {
+                    delete[] table->pages[entry];
+                    table->owned[entry] = false;
+                    --pageCount_;
+                }
+                table->pages[entry] = const_cast<ByteType*>(data + i);
+            }
+        }
+        Copy(section.address + shared, data + shared, section.fileSize - shared);
+        Zero(section.address + section.fileSize, section.size - section.fileSize);
+    }
+    readPage_ = writePage_ = ~WordType(0);
+}
+
+SizeType Memory::PageCount() const { return pageCount_; }
+
 WordType Memory::ReadInstruction(SizeType index) const {
-    return *(reinterpret_cast<WordType*>(memory_ + index));
+    return Read<WordType>(index);
 }
@@ -14,27 +14,67 @@
 // You should have received a copy of the GNU General Public License
 // along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
+
 #include "predictor.h"
 
-#include <utility>
 #include <cmath>
+#include <cstdlib>
+#include <iomanip>
 
-Predictor::Predictor() : totalCorrect_(0), totalWrong_(0) {}
+namespace {
 
-bool Predictor::Predict(WordType instructionAddress) {
-    ByteType index = instructionAddress & kAnd;
-    return patternHistoryTable_[index].prediction[history_[index]];
+void Saturate(ByteType& counter, bool up, ByteType max = 3) {
+    if (up) {
+        if (counter < max) ++counter;
+    } else {
+        if (counter > 0) --counter;
+    }
+}
+
+/// Fold the latest length bits of the history into bits bits by XOR.
+SizeType Fold(HistoryType history, SizeType length, SizeType bits) {
+    if (length < 64) history &= (HistoryType(1) << length) - 1;
+    SizeType folded = 0;
+    for (SizeType shift = 0; shift < length; shift += bits) {
+        folded ^= static_cast<SizeType>(history >> shift);
+    }
+    return folded & ((1u << bits) - 1);
+}
+
+} // namespace
+
+std::unique_ptr<Predictor> Predictor::Create(const PredictorConfig& config) {
+    std::unique_ptr<Predictor> predictor;
+    switch (config.type) {
+        case PredictorType::local:      predictor = std::make_unique<LocalPredictor>();      break;
+        case PredictorType::bimodal:    predictor = std::make_unique<BimodalPredictor>();    break;
+        case PredictorType::gshare:     predictor = std::make_unique<GsharePredictor>();     break;
+        case PredictorType::tournament: predictor = std::make_unique<TournamentPredictor>(); break;
+        case PredictorType::tage:       predictor = std::make_unique<TagePredictor>();       break;
+        case PredictorType::perceptron:
+            predictor = std::make_unique<PerceptronPredictor>(config.perceptronHistory,
+                                                              config.perceptronWeightBits);
+            break;
+    }
+    predictor->recordBranches_ = config.branchStatistics;
+    return predictor;
 }
 
-void Predictor::Update(WordType instructionAddress, bool answer) {
-    ByteType index = instructionAddress & kAnd;
-    if (patternHistoryTable_[index].prediction[history_[index]] == answer) {
+void Predictor::Update(WordType instructionAddress, bool answer, bool prediction) {
+    if (prediction == answer) {
         totalCorrect_++;
     } else {
         totalWrong_++;
     }
-    patternHistoryTable_[index].prediction[history_[index]] = answer;
-    history_[index] = history_[index] >> 1 | (answer ? 0b1000 : 0);
+    if (recordBranches_) {
+        BranchRecord& record = branches_[instructionAddress];
+        if (prediction == answer) {
+            record.correct++;
+        } else {
+            record.wrong++;
+        }
+    }
+    Train(instructionAddress, answer);
 }
 
 float Predictor::GetAccuracy() const {
@@ -43,3 +83,239 @@ float Predictor::GetAccuracy() const {
     }
     return static_cast<float>(totalCorrect_) / static_cast<float>(totalCorrect_ + totalWrong_);
 }
+
+void Predictor::PrintBranchStatistics(std::ostream& out) const {
+    if (!recordBranches_) return;
+    std::ios::fmtflags flags = out.flags();
+    out << "Branch       Correct   Total     Accuracy\n";
+    for (const auto& [address, record] : branches_) {
+        SizeType total = record.correct + record.wrong;
+        out << "0x" << std::hex << std::setw(8) << std::setfill('0') << address
+            << std::dec << std::setfill(' ') << "   "
+            << std::left << std::setw(10) << record.correct << std::setw(10) << total
+            << std::right << std::fixed << std::setprecision(2)
+            << static_cast<float>(record.correct) * 100 / static_cast<float>(total) << "%\n";
+    }
+    out.flags(flags);
+}
+
+bool LocalPredictor::Predict(WordType instructionAddress) const {
+    SizeType index = (instructionAddress >> 2) & kAnd;
+    return patternHistoryTable_[index].prediction[history_[index]];
+}
+
+void LocalPredictor::Train(WordType instructionAddress, bool answer) {
+    SizeType index = (instructionAddress >> 2) & kAnd;
+    patternHistoryTable_[index].prediction[history_[index]] = answer;
+    history_[index] = history_[index] >> 1 | (answer ? 0b1000 : 0);
+}
+
+bool BimodalPredictor::Predict(WordType instructionAddress) const {
+    return counters_[(instructionAddress >> 2) & (kCounterCount - 1)] >= 2;
+}
+
+void BimodalPredictor::Train(WordType instructionAddress, bool answer) {
+    Saturate(counters_[(instructionAddress >> 2) & (kCounterCount - 1)], answer);
+}
+
+SizeType GsharePredictor::Index(WordType instructionAddress, WordType history) {
+    return ((instructionAddress >> 2) ^ history) & (kCounterCount - 1);
+}
+
+WordType GsharePredictor::NextHistory(WordType history, bool answer) {
+    return (history << 1 | (answer ? 1 : 0)) & (kCounterCount - 1);
+}
+
+bool GsharePredictor::Predict(WordType instructionAddress) const {
+    return counters_[Index(instructionAddress, speculativeHistory_)] >= 2;
+}
+
+bool GsharePredictor::PredictAtCommit(WordType instructionAddress) const {
+    return counters_[Index(instructionAddress, history_)] >= 2;
+}
+
+void GsharePredictor::Speculate(WordType /*instructionAddress*/, bool prediction) {
+    speculativeHistory_ = NextHistory(speculativeHistory_, prediction);
+}
+
+HistoryType GsharePredictor::Save() const { return speculativeHistory_; }
+
+void GsharePredictor::Restore(HistoryType history) { speculativeHistory_ = history; }
+
+void GsharePredictor::Restore() { speculativeHistory_ = history_; }
+
+void GsharePredictor::Train(WordType instructionAddress, bool answer) {
+    Saturate(counters_[Index(instructionAddress, history_)], answer);
+    history_ = NextHistory(history_, answer);
+}
+
+bool TournamentPredictor::Predict(WordType instructionAddress) const {
+    if (chooser_[(instructionAddress >> 2) & (kChooserCount - 1)] >= 2) {
+        return global_.Predict(instructionAddress);
+    }
+    return local_.Predict(instructionAddress);
+}
+
+void TournamentPredictor::Speculate(WordType instructionAddress, bool prediction) {
+    global_.Speculate(instructionAddress, prediction);
+}
+
+HistoryType TournamentPredictor::Save() const { return global_.Save(); }
+
+void TournamentPredictor::Restore(HistoryType history) { global_.Restore(history); }
+
+void TournamentPredictor::Restore() { global_.Restore(); }
+
+void TournamentPredictor::Train(WordType instructionAddress, bool answer) {
+    bool localCorrect = local_.Predict(instructionAddress) == answer;
+    bool globalCorrect = global_.PredictAtCommit(instructionAddress) == answer;
+    if (localCorrect != globalCorrect) {
+        Saturate(chooser_[(instructionAddress >> 2) & (kChooserCount - 1)], globalCorrect);
+    }
+    local_.Train(instructionAddress, answer);
+    global_.Train(instructionAddress, answer);
+}
+
+TagePredictor::Lookup TagePredictor::Find(WordType instructionAddress, HistoryType history) const {
+    Lookup lookup;
+    WordType pc = instructionAddress >> 2;
+    for (SizeType i = 0; i < kTableCount; ++i) {
+        lookup.index[i] = (pc ^ (pc >> kIndexBits) ^ Fold(history, kHistoryLengths[i], kIndexBits))
+                          & ((1u << kIndexBits) - 1);
+        lookup.tag[i] = (pc ^ Fold(history, kHistoryLengths[i], kTagBits) ^
+                         (Fold(history, kHistoryLengths[i], kTagBits - 1) << 1))
+                        & ((1u << kTagBits) - 1);
+    }
+    for (int i = kTableCount - 1; i >= 0; --i) {
+        const Entry& entry = tables_[i][lookup.index[i]];
+        if (!entry.valid || entry.tag != lookup.tag[i]) continue;
+        if (lookup.provider < 0) {
+            lookup.provider = i;
+        } else {
+            lookup.alternative = i;
+            break;
+        }
+    }
+    bool basePrediction = base_[pc & (kBaseCount - 1)] >= 2;
+    lookup.alternativePrediction = lookup.alternative < 0
+            ? basePrediction
+            : tables_[lookup.alternative][lookup.index[lookup.alternative]].counter >= 4;
+    lookup.prediction = lookup.provider < 0
+            ? basePrediction
+            : tables_[lookup.provider][lookup.index[lookup.provider]].counter >= 4;
+    return lookup;
+}
+
+bool TagePredictor::Predict(WordType instructionAddress) const {
+    return Find(instructionAddress, speculativeHistory_).prediction;
+}
+
+void TagePredictor::Speculate(WordType /*instructionAddress*/, bool prediction) {
+    speculativeHistory_ = speculativeHistory_ << 1 | (prediction ? 1 : 0);
+}
+
+HistoryType TagePredictor::Save() const { return speculativeHistory_; }
+
+void TagePredictor::Restore(HistoryType history) { speculativeHistory_ = history; }
+
+void TagePredictor::Restore() { speculativeHistory_ = history_; }
+
+void TagePredictor::Train(WordType instructionAddress, bool answer) {
+    // the committed history is the one the branch was predicted with
+    Lookup lookup = Find(instructionAddress, history_);
+    if (lookup.provider < 0) {
+        Saturate(base_[(instructionAddress >> 2) & (kBaseCount - 1)], answer);
+    } else {
+        Entry& provider = tables_[lookup.provider][lookup.index[lookup.provider]];
+        if (lookup.prediction != lookup.alternativePrediction) {
+            Saturate(provider.useful, lookup.prediction == answer);
+        }
+        Saturate(provider.counter, answer, 7);
+    }
+    if (lookup.prediction != answer && lookup.provider + 1 < static_cast<int>(kTableCount)) {
+        // allocate in one of the longer tables, starting at a varying one
+        // so that the allocations do not always go to the shortest
+        bool allocated = false;
+        SizeType first = lookup.provider + 1;
+        if (first + 1 < kTableCount && (allocationSeed_++ & 1)) ++first;
+        for (SizeType i = first; i < kTableCount && !allocated; ++i) {
+            Entry& entry = tables_[i][lookup.index[i]];
+            if (entry.useful == 0) {
+                entry.tag = static_cast<HalfWordType>(lookup.tag[i]);
+                entry.counter = answer ? 4 : 3;
+                entry.valid = true;
+                allocated = true;
+            }
+        }
+        if (!allocated) {
+            for (SizeType i = lookup.provider + 1; i < kTableCount; ++i) {
+                Saturate(tables_[i][lookup.index[i]].useful, false);
+            }
+        }
+    }
+    if (++updateCount_ % kAgingPeriod == 0) {
+        for (auto& table : tables_) {
+            for (auto& entry : table) entry.useful >>= 1;
+        }
+    }
+    history_ = history_ << 1 | (answer ? 1 : 0);
+}
+
+PerceptronPredictor::PerceptronPredictor(SizeType historyLength, SizeType weightBits)
+    : historyLength_(historyLength),
+      maxWeight_((1 << (weightBits - 1)) - 1),
+      threshold_(static_cast<int>(1.93 * historyLength + 14)),
+      weights_(std::make_unique<int16_t[]>(kPerceptronCount * (historyLength + 1))) {}
+
+int16_t* PerceptronPredictor::Weights(WordType instructionAddress) {
+    WordType pc = instructionAddress >> 2;
+    return &weights_[((pc ^ (pc >> 10)) & (kPerceptronCount - 1)) * (historyLength_ + 1)];
+}
+
+const int16_t* PerceptronPredictor::Weights(WordType instructionAddress) const {
+    WordType pc = instructionAddress >> 2;
+    return &weights_[((pc ^ (pc >> 10)) & (kPerceptronCount - 1)) * (historyLength_ + 1)];
+}
+
+int PerceptronPredictor::Output(WordType instructionAddress, HistoryType history) const {
+    const int16_t* weights = Weights(instructionAddress);
+    int output = weights[0];
+    for (SizeType i = 0; i < historyLength_; ++i) {
+        output += (history >> i & 1) ? weights[i + 1] : -weights[i + 1];
+    }
+    return output;
+}
+
+bool PerceptronPredictor::Predict(WordType instructionAddress) const {
+    return Output(instructionAddress, speculativeHistory_) >= 0;
+}
+
+void PerceptronPredictor::Speculate(WordType /*instructionAddress*/, bool prediction) {
+    speculativeHistory_ = speculativeHistory_ << 1 | (prediction ? 1 : 0);
+}
+
+HistoryType PerceptronPredictor::Save() const { return speculativeHistory_; }
+
+void PerceptronPredictor::Restore(HistoryType history) { speculativeHistory_ = history; }
+
+void PerceptronPredictor::Restore() { speculativeHistory_ = history_; }
+
+void PerceptronPredictor::Train(WordType instructionAddress, bool answer) {
+    // the committed history is the one the branch was predicted with
+    int output = Output(instructionAddress, history_);
+    if ((output >= 0) != answer || std::abs(output) <= threshold_) {
+        int16_t* weights = Weights(instructionAddress);
+        auto train = [this](int16_t& weight, bool up) {
+            if (up) {
+                if (weight < maxWeight_) ++weight;
+            } else {
+                if (weight > -maxWeight_ - 1) --weight;
+            }
+        };
+        train(weights[0], answer);
+        for (SizeType i = 0; i < historyLength_; ++i) {
+            train(weights[i + 1], (history_ >> i & 1) == answer);
+        }
+    }
+    history_ = history_ << 1 | (answer ? 1 : 0);
+}
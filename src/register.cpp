@@ -29,67 +29,133 @@ Register& Register::operator=(WordType data) {
     return *this;
 }
 
-bool Register::Dirty() const { return dirty_; }
-
-void Register::SetDependency(SizeType index) {
-    dependency_ = index;
-    dirty_ = true;
+Register& Register::operator+=(SignedWordType rhs) {
+    value_ += rhs;
+    return *this;
 }
 
-void Register::TryResetWithIndex(SizeType index) {
-    if (index == dependency_) {
-        dirty_ = false;
+RegisterFile::RegisterFile(SizeType physicalCount)
+    : freeList_(physicalCount),
+      freeCount_(physicalCount - kRegisterCount),
+      mappings_(physicalCount, 1),
+      moves_(physicalCount),
+      registers_(physicalCount),
+      nextRegisters_(physicalCount) {
+    for (SizeType i = 0; i < kRegisterCount; ++i) {
+        map_[i] = i;
+        committedMap_[i] = i;
+    }
+    for (SizeType i = 0; i < freeCount_; ++i) {
+        freeList_[i] = kRegisterCount + i;
     }
 }
 
-void Register::ResetDependency() {
-    dirty_ = false;
+const PhysicalRegister& RegisterFile::operator[](SizeType physical) {
+    return nextRegisters_[physical];
 }
 
-SizeType Register::Dependency() const {
-    return dependency_;
+const PhysicalRegister& RegisterFile::operator[](SizeType physical) const {
+    return registers_[physical];
 }
 
-Register& Register::operator+=(SignedWordType rhs) {
-    value_ += rhs;
-    return *this;
+void RegisterFile::Write(SizeType physical, WordType value) {
+    if (physical == 0) return;
+    nextRegisters_[physical].value = value;
+    nextRegisters_[physical].ready = true;
+    changed_.push_back(physical);
+    written_.push_back(physical);
+}
+
+SizeType RegisterFile::Map(SizeType index) const { return map_[index]; }
+
+const std::vector<SizeType>& RegisterFile::Broadcast() const { return broadcast_; }
+
+bool RegisterFile::Full() const { return freeCount_ == 0; }
+
+SizeType RegisterFile::Rename(SizeType index, SizeType& previous) {
+    if (index == 0) {
+        previous = 0;
+        return 0;
+    }
+    SizeType physical = freeList_[freeHead_];
+    freeHead_ = (freeHead_ + 1) % freeList_.size();
+    --freeCount_;
+    previous = map_[index];
+    map_[index] = physical;
+    mappings_[physical] = 1;
+    nextRegisters_[physical].ready = false;
+    changed_.push_back(physical);
+    return physical;
 }
 
-WordType RegisterFile::Read(SizeType index) {
-    return static_cast<WordType>(registers_[index]);
+SizeType RegisterFile::Move(SizeType index, SizeType source, SizeType& previous) {
+    SizeType physical = map_[source];
+    previous = map_[index];
+    map_[index] = physical;
+    ++mappings_[physical];
+    moves_[(moveHead_ + moveCount_) % moves_.size()] = physical;
+    ++moveCount_;
+    return physical;
 }
 
-void RegisterFile::Write(SizeType index, WordType value, SizeType dependency) {
-    if (index != 0) {
+void RegisterFile::Commit(SizeType index, SizeType physical, SizeType previous, bool moved) {
+    if (index == 0) return;
 #ifdef LAU_SHOW_REGISTER_DETAILS
-        std::cerr << "Register " << index << "\t<- " << value << std::endl;
+    std::cerr << "Register " << index << "\t<- " << registers_[physical].value << std::endl;
 #endif
-        nextRegisters_[index] = value;
-        nextRegisters_[index].TryResetWithIndex(dependency);
+    committedMap_[index] = physical;
+    if (moved) {
+        moveHead_ = (moveHead_ + 1) % moves_.size();
+        --moveCount_;
+    } else {
+        committedHead_ = (committedHead_ + 1) % freeList_.size();
     }
+    Release(previous);
 }
 
-void RegisterFile::AboutToWrite(SizeType index, SizeType dependency) {
-    if (index == 0) return;
-    nextRegisters_[index].SetDependency(dependency);
+void RegisterFile::Release(SizeType physical) {
+    if (physical == 0 || --mappings_[physical] > 0) return;
+    freeList_[(freeHead_ + freeCount_) % freeList_.size()] = physical;
+    ++freeCount_;
 }
 
-void RegisterFile::ResetDependency() {
-    for (auto& register_ : nextRegisters_) {
-        register_.ResetDependency();
-    }
+WordType RegisterFile::Read(SizeType index) const {
+    return registers_[committedMap_[index]].value;
 }
 
-void RegisterFile::Flush() {
-    for (SizeType i = 0; i < kRegisterCount; ++i) {
-        registers_[i] = nextRegisters_[i];
+void RegisterFile::Reset() {
+    SizeType size = freeList_.size();
+    freeCount_ += (freeHead_ + size - committedHead_) % size;
+    freeHead_ = committedHead_;
+    for (; moveCount_ > 0; --moveCount_) {
+        --mappings_[moves_[(moveHead_ + moveCount_ - 1) % moves_.size()]];
     }
+    for (SizeType i = 0; i < kRegisterCount; ++i) map_[i] = committedMap_[i];
+}
+
+RegisterFile::Checkpoint RegisterFile::Save() const {
+    Checkpoint checkpoint;
+    for (SizeType i = 0; i < kRegisterCount; ++i) checkpoint.map[i] = map_[i];
+    checkpoint.freeHead = freeHead_;
+    checkpoint.moveTail = (moveHead_ + moveCount_) % moves_.size();
+    return checkpoint;
 }
 
-bool RegisterFile::Dirty(SizeType index) const {
-    return registers_[index].Dirty();
+void RegisterFile::Restore(const Checkpoint& checkpoint) {
+    SizeType size = freeList_.size();
+    freeCount_ += (freeHead_ + size - checkpoint.freeHead) % size;
+    freeHead_ = checkpoint.freeHead;
+    // the moves before the checkpoint may have been committed since
+    SizeType kept = (checkpoint.moveTail + moves_.size() - moveHead_) % moves_.size();
+    for (; moveCount_ > kept; --moveCount_) {
+        --mappings_[moves_[(moveHead_ + moveCount_ - 1) % moves_.size()]];
+    }
+    for (SizeType i = 0; i < kRegisterCount; ++i) map_[i] = checkpoint.map[i];
 }
 
-SizeType RegisterFile::Dependency(SizeType index) const {
-    return registers_[index].Dependency();
+void RegisterFile::Flush() {
+    for (SizeType physical : changed_) registers_[physical] = nextRegisters_[physical];
+    changed_.clear();
+    broadcast_.swap(written_);
+    written_.clear();
 }
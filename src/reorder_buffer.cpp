@@ -30,28 +30,61 @@ const ReorderBufferEntry& ReorderBuffer::operator[](SizeType index) const {
     return buffer_[index];
 }
 
+ReorderBuffer::ReorderBuffer(const Config& config)
+    : commitWidth_(config.commitWidth) {}
+
 void ReorderBuffer::TryCommit(Bus& bus) {
-    if (buffer_.Empty()) return;
-    if (!buffer_.Front().ready) return;
-    switch (buffer_.Front().type) {
+    SizeType index = buffer_.HeadIndex();
+    SizeType end = (buffer_.TailIndex() + 1) % buffer_.Capacity();
+    for (SizeType i = 0; i < commitWidth_ && index != end; ++i) {
+        if (!buffer_[index].ready) return;
+        if (!Commit(buffer_[index], bus)) return;
+        index = (index + 1) % buffer_.Capacity();
+    }
+}
+
+bool ReorderBuffer::Commit(const ReorderBufferEntry& entry, Bus& bus) {
+    bus.CommitReturnAddress(entry.stackOperation, entry.value);
+    switch (entry.type) {
         case ReorderType::registerWrite:
-            // Note that the register can only be updated in the reorder buffer
-            bus.RegisterCommit(buffer_.Front().index,
-                               buffer_.Front().value,
-                               buffer_.HeadIndex());
-            break;
+            // the value is in the physical register, which becomes architectural
+            bus.RegisterCommit(entry.index, entry.physical, entry.previous, entry.moved);
+            nextBuffer_.Pop();
+            return true;
         case ReorderType::memoryWrite:
-            bus.GetLoadStoreBuffer()[buffer_.Front().index].ready = true;
-            break;
-        case ReorderType::branch: {
-            bool realAnswer = static_cast<bool>(buffer_.Front().value);
-            bus.UpdatePredictor(buffer_.Front().address, realAnswer);
-            if (buffer_.Front().predictedAnswer != realAnswer) {
+            // the load/store buffer writes one entry per cycle
+            bus.GetLoadStoreBuffer()[entry.index].ready = true;
+            nextBuffer_.Pop();
+            return false;
+        case ReorderType::branch:
+            // a mispredicted branch has been recovered from when it was resolved
+            bus.UpdatePredictor(entry.address, static_cast<bool>(entry.value),
+                                entry.predictedAnswer);
+            nextBuffer_.Pop();
+            return true;
+        case ReorderType::jump: {
+            // all the older instructions have written the register file
+            WordType target = (bus.GetRegisterFile().Read(entry.baseRegister) + entry.offset) & ~1u;
+            bus.RegisterCommit(entry.index, entry.physical, entry.previous, false);
+            bool isReturn = entry.stackOperation == StackOperation::pop ||
+                            entry.stackOperation == StackOperation::popAndPush;
+            bus.UpdateTargetPredictor(entry.address, target);
+            if (!entry.predictedAnswer) {
+                nextBuffer_.Pop();
+                return true;
+            }
+            if (isReturn) {
+                bus.GetReturnAddressStack().Record(target == entry.predictedTarget);
+            } else {
+                bus.GetTargetPredictor().Record(target == entry.predictedTarget);
+            }
+            if (target != entry.predictedTarget) {
                 bus.ClearPipeline();
-                bus.SetPC(buffer_.Front().index);
-                return; // skip the pop
+                bus.SetPC(target);
+                return false; // skip the pop
             }
-            break;
+            nextBuffer_.Pop();
+            return true;
         }
         case ReorderType::end:
             std::cout << (static_cast<HalfWordType>(bus.GetRegisterFile().Read(10)) & 255u)
@@ -66,27 +99,50 @@ void ReorderBuffer::TryCommit(Bus& bus) {
                 std::cerr << "Predictor accuracy: N/A (no prediction in this testcase)"
                           << std::endl;
             }
+            std::cerr << "Decode cache hit rate: "
+                      << std::fixed << std::setprecision(2)
+                      << bus.DecodeCacheHitRate() * 100 << "%." << std::endl;
+            std::cerr << "Eliminated at rename: " << bus.EliminatedInstructions()
+                      << " instructions." << std::endl;
+            bus.PrintFusionStatistics(std::cerr);
+            bus.GetReservationStation().PrintOccupancy(std::cerr);
+            std::cerr << "Return address stack: " << bus.GetReturnAddressStack().Hits()
+                      << " hits, " << bus.GetReturnAddressStack().Misses() << " misses."
+                      << std::endl;
+            std::cerr << "Target predictor: " << bus.GetTargetPredictor().Hits()
+                      << " hits, " << bus.GetTargetPredictor().Misses() << " misses."
+                      << std::endl;
+            std::cerr << "Memory pages: " << bus.GetMemory().PageCount() << "." << std::endl;
 #endif
-            exit(0);
+            bus.GetPredictor().PrintBranchStatistics(std::cerr);
+            bus.Halt(0);
+            return false;
+        case ReorderType::illegal:
+            std::cerr << "Illegal instruction 0x" << std::hex << std::setw(8) << std::setfill('0')
+                      << entry.value << " at 0x" << std::setw(8)
+                      << entry.address << "." << std::dec << std::setfill(' ') << std::endl;
+            bus.Halt(1);
+            return false;
         default:
             assert(false); // should never happen
+            return false;
     }
-    nextBuffer_.Pop();
 }
 
 void ReorderBuffer::Flush() { buffer_ = nextBuffer_; }
 void ReorderBuffer::Clear() { nextBuffer_.Clear(); }
 
-bool ReorderBuffer::Full() const { return buffer_.Full(); }
+bool ReorderBuffer::Full() const { return nextBuffer_.Full(); }
 
-SizeType ReorderBuffer::Add(const ReorderBufferEntry& entry, Bus& bus) {
+SizeType ReorderBuffer::Add(const ReorderBufferEntry& entry) {
     nextBuffer_.Push(entry);
-    if (entry.type == ReorderType::registerWrite) {
-        bus.GetRegisterFile().AboutToWrite(entry.index, nextBuffer_.TailIndex());
-    }
     return nextBuffer_.TailIndex();
 }
 
+void ReorderBuffer::SquashAfter(SizeType index) {
+    nextBuffer_.SetAsEnd((index + 1) % nextBuffer_.Capacity());
+}
+
 const ReorderBufferEntry& ReorderBuffer::GetEntry(SizeType index) const {
     return buffer_[index];
 }
@@ -17,12 +17,57 @@
 #include "reservation_station.h"
 
 #include <cassert>
+#include <iomanip>
 
+#include "bus.h"
+#include "register.h"
 #include "reorder_buffer.h"
 
+namespace {
+
+const char* const kUnitNames[] = {"add", "shift", "set", "logic"};
+
+/**
+ * Get the number of entries, shared or in the queues.
+ */
+SizeType EntryCount(const Config& config) {
+    SizeType count = 0;
+    for (SizeType size : config.reservationQueues) count += size;
+    return count > 0 ? count : config.reservationStationSize;
+}
+
+} // namespace
+
+ReservationStation::ReservationStation(const Config& config)
+    : entries_(EntryCount(config)),
+      all_(EntryMask::Lowest(EntryCount(config))),
+      split_(config.reservationQueues[0] > 0),
+      older_(EntryCount(config)),
+      consumers_(config.physicalRegisters),
+      oldestFirst_(config.select == SelectPolicy::oldest) {
+    for (const auto& [instruction, timing] : config.timings) {
+        timings_[static_cast<SizeType>(instruction)] = timing;
+    }
+    SizeType begin = 0;
+    for (SizeType unit = 0; unit < unitCount; ++unit) {
+        if (!split_) {
+            queues_[unit] = all_;
+            continue;
+        }
+        SizeType end = begin + config.reservationQueues[unit];
+        queues_[unit] = EntryMask::Lowest(end) & ~EntryMask::Lowest(begin);
+        begin = end;
+    }
+}
+
 void ReservationStation::Flush() {
-    for (SizeType i = 0; i < kEntryNumber_; ++i) {
-        entries_[i] = nextEntries_[i];
+    used_ = nextUsed_;
+    waiting_ = nextWaiting_;
+    executing_ = nextExecuting_;
+    ++cycles_;
+    for (SizeType unit = 0; unit < unitCount; ++unit) {
+        occupancy_[unit] += (used_ & units_[unit]).Count();
+        if ((queues_[unit] & ~used_).Empty()) ++fullCycles_[unit];
     }
     for (auto& alu : addALU_) alu.Flush();
     for (auto& alu : shiftALU_) alu.Flush();
@@ -30,147 +75,230 @@ void ReservationStation::Flush() {
     for (auto& alu : setALU_) alu.Flush();
 }
 
-void ReservationStation::Execute(ReorderBuffer& reorderBuffer) {
-    this->FetchResult(reorderBuffer);
+void ReservationStation::Execute(Bus& bus) {
+    ResolvedBranches branches;
+    this->FetchResult(bus.GetReorderBuffer(), bus.GetRegisterFile(), branches);
     this->PushDataIntoALU();
-    this->UpdateBusyState(reorderBuffer);
+    this->UpdateBusyState(bus.GetRegisterFile());
+    if (branches.correct != 0) {
+        bus.ResolveBranches(branches.correct);
+    }
+    if (branches.mispredicted) {
+        bus.RecoverBranch(branches.oldestMispredicted);
+    }
 }
 
-void ReservationStation::FetchResult(ReorderBuffer& reorderBuffer) {
+void ReservationStation::FetchResult(ReorderBuffer& reorderBuffer, RegisterFile& registerFile,
+                                     ResolvedBranches& branches) {
     for (auto& alu : addALU_) {
         if (alu.Finished()) {
-            reorderBuffer[entries_[alu.Index()].RoBIndex].value = alu.Result();
+            registerFile.Write(entries_[alu.Index()].destination, alu.Result());
             reorderBuffer[entries_[alu.Index()].RoBIndex].ready = true;
-            nextEntries_[alu.Index()].empty = true;
+            nextUsed_.Reset(alu.Index());
         }
     }
     for (auto& alu : shiftALU_) {
         if (alu.Finished()) {
-            reorderBuffer[entries_[alu.Index()].RoBIndex].value = alu.Result();
+            registerFile.Write(entries_[alu.Index()].destination, alu.Result());
             reorderBuffer[entries_[alu.Index()].RoBIndex].ready = true;
-            nextEntries_[alu.Index()].empty = true;
+            nextUsed_.Reset(alu.Index());
         }
     }
     for (auto& alu : setALU_) {
         if (alu.Finished()) {
-            reorderBuffer[entries_[alu.Index()].RoBIndex].value = alu.Result();
-            reorderBuffer[entries_[alu.Index()].RoBIndex].ready = true;
-            nextEntries_[alu.Index()].empty = true;
+            const RSEntry& entry = entries_[alu.Index()];
+            reorderBuffer[entry.RoBIndex].ready = true;
+            nextUsed_.Reset(alu.Index());
+            if (!IsBranch(entry.instruction)) {
+                registerFile.Write(entry.destination, alu.Result());
+                continue;
+            }
+            reorderBuffer[entry.RoBIndex].value = alu.Result();
+            SizeType tag = reorderBuffer[entry.RoBIndex].checkpoint;
+            if (reorderBuffer[entry.RoBIndex].predictedAnswer == static_cast<bool>(alu.Result())) {
+                branches.correct |= BranchMask{1} << tag;
+            } else if (!branches.mispredicted || (entry.branchMask >> branches.oldestTag & 1) == 0) {
+                // the other one is younger if this one is not after it
+                branches.mispredicted = true;
+                branches.oldestMispredicted = entry.RoBIndex;
+                branches.oldestTag = tag;
+            }
         }
     }
     for (auto& alu : logicALU_) {
         if (alu.Finished()) {
-            reorderBuffer[entries_[alu.Index()].RoBIndex].value = alu.Result();
+            registerFile.Write(entries_[alu.Index()].destination, alu.Result());
             reorderBuffer[entries_[alu.Index()].RoBIndex].ready = true;
-            nextEntries_[alu.Index()].empty = true;
+            nextUsed_.Reset(alu.Index());
         }
     }
 }
 
-void ReservationStation::PushDataIntoALU() {
-    for (SizeType i = 0; i < kEntryNumber_; ++i) {
-        if (!entries_[i].empty && !entries_[i].busy && !entries_[i].executing) {
-            switch (entries_[i].instruction) {
-                case Instruction::ADD:
-                case Instruction::SUB:
-                case Instruction::ADDI:
-                    for (auto& alu : addALU_) {
-                        if (!alu.Busy()) {
-                            alu.Execute(entries_[i].Value1, entries_[i].Value2, i, entries_[i].instruction);
-                            nextEntries_[i].executing = true;
-                            break;
-                        }
-                    }
-                    break;
-                case Instruction::SLL:
-                case Instruction::SLLI:
-                case Instruction::SRL:
-                case Instruction::SRLI:
-                case Instruction::SRA:
-                case Instruction::SRAI:
-                    for (auto& alu : shiftALU_) {
-                        if (!alu.Busy()) {
-                            alu.Execute(entries_[i].Value1, entries_[i].Value2, i, entries_[i].instruction);
-                            nextEntries_[i].executing = true;
-                            break;
-                        }
-                    }
-                    break;
-                case Instruction::SLT:
-                case Instruction::SLTI:
-                case Instruction::SLTU:
-                case Instruction::SLTIU:
-                case Instruction::BEQ:
-                case Instruction::BNE:
-                case Instruction::BLT:
-                case Instruction::BGE:
-                case Instruction::BLTU:
-                case Instruction::BGEU:
-                    for (auto& alu : setALU_) {
-                        if (!alu.Busy()) {
-                            alu.Execute(entries_[i].Value1, entries_[i].Value2, i, entries_[i].instruction);
-                            nextEntries_[i].executing = true;
-                            break;
-                        }
-                    }
-                    break;
-                case Instruction::XOR:
-                case Instruction::XORI:
-                case Instruction::OR:
-                case Instruction::ORI:
-                case Instruction::AND:
-                case Instruction::ANDI:
-                    for (auto& alu : logicALU_) {
-                        if (!alu.Busy()) {
-                            alu.Execute(entries_[i].Value1, entries_[i].Value2, i, entries_[i].instruction);
-                            nextEntries_[i].executing = true;
-                            break;
-                        }
-                    }
-                    break;
-                default:
-                    assert(false);
-            }
-        }
+template<class ALUType, SizeType kCount>
+void ReservationStation::Select(ALUType (&alus)[kCount], EntryMask requests) {
+    for (auto& alu : alus) {
+        if (requests.Empty()) return;
+        SizeType i = oldestFirst_ ? Oldest(requests) : requests.First();
+        const Timing& timing = timings_[static_cast<SizeType>(entries_[i].instruction)];
+        if (!alu.Ready(timing)) continue;
+        requests.Reset(i);
+        alu.Execute(entries_[i].Value1, entries_[i].Value2, i, entries_[i].instruction, timing);
+        nextExecuting_.Set(i);
     }
 }
 
-void ReservationStation::UpdateBusyState(const ReorderBuffer& reorderBuffer) {
-    for (SizeType i = 0; i < kEntryNumber_; ++i) {
-        if (entries_[i].empty) continue;
-        if (entries_[i].Q1Constraint) {
-            if (reorderBuffer[entries_[i].Q1].ready) {
-                nextEntries_[i].Value1 = reorderBuffer[entries_[i].Q1].value;
-                nextEntries_[i].Q1Constraint = false;
+SizeType ReservationStation::Oldest(const EntryMask& entries) const {
+    EntryMask rest = entries;
+    for (SizeType i = rest.First(); i != EntryMask::kNotFound; i = rest.First()) {
+        if ((older_[i] & entries).Empty()) return i;
+        rest.Reset(i);
+    }
+    assert(false);
+    return EntryMask::kNotFound;
+}
+
+void ReservationStation::PushDataIntoALU() {
+    EntryMask ready = used_ & ~waiting_ & ~executing_;
+    Select(addALU_, ready & units_[addUnit]);
+    Select(shiftALU_, ready & units_[shiftUnit]);
+    Select(setALU_, ready & units_[setUnit]);
+    Select(logicALU_, ready & units_[logicUnit]);
+}
+
+void ReservationStation::UpdateBusyState(const RegisterFile& registerFile) {
+    for (SizeType physical : registerFile.Broadcast()) {
+        const PhysicalRegister& source = registerFile[physical];
+        // renamed again after a squashed instruction wrote it
+        if (!source.ready) continue;
+        // The entries added in this cycle are not seen until the next one,
+        // and the squashed ones are left behind.
+        EntryMask woken = consumers_[physical] & used_ & waiting_;
+        consumers_[physical] &= ~woken;
+        woken.ForEach([&](SizeType i) {
+            RSEntry& entry = entries_[i];
+            if (entry.Q1Constraint && entry.Q1 == physical) {
+                entry.Value1 = source.value;
+                entry.Q1Constraint = false;
             }
-        }
-        if (entries_[i].Q2Constraint) {
-            if (reorderBuffer[entries_[i].Q2].ready) {
-                nextEntries_[i].Value2 = reorderBuffer[entries_[i].Q2].value;
-                nextEntries_[i].Q2Constraint = false;
+            if (entry.Q2Constraint && entry.Q2 == physical) {
+                entry.Value2 = source.value;
+                entry.Q2Constraint = false;
             }
-        }
-        if (!nextEntries_[i].Q1Constraint && !nextEntries_[i].Q2Constraint) {
-            nextEntries_[i].busy = false;
-        }
+            if (!entry.Q1Constraint && !entry.Q2Constraint) {
+                nextWaiting_.Reset(i);
+            }
+        });
     }
 }
 
+bool ReservationStation::Full(Instruction instruction) const {
+    Unit unit = GetUnit(instruction);
+    return unit != unitCount && (queues_[unit] & ~nextUsed_).Empty();
+}
+
 bool ReservationStation::Add(const RSEntry& entry) {
-    for (SizeType i = 0; i < kEntryNumber_; ++i) {
-        if (entries_[i].empty) {
-            nextEntries_[i] = entry;
-            nextEntries_[i].empty = false;
-            return true;
-        }
+    Unit unit = GetUnit(entry.instruction);
+    assert(unit != unitCount);
+    // Look at the next state so that several entries can be added in a cycle.
+    SizeType i = (queues_[unit] & ~nextUsed_).First();
+    if (i == EntryMask::kNotFound) return false;
+    entries_[i] = entry;
+    if (oldestFirst_) {
+        // the entries are added in program order
+        nextUsed_.ForEach([&](SizeType j) { older_[j].Reset(i); });
+        older_[i] = nextUsed_;
+    }
+    nextUsed_.Set(i);
+    if (entry.busy) {
+        nextWaiting_.Set(i);
+        if (entry.Q1Constraint) consumers_[entry.Q1].Set(i);
+        if (entry.Q2Constraint) consumers_[entry.Q2].Set(i);
+    } else {
+        nextWaiting_.Reset(i);
+    }
+    nextExecuting_.Reset(i);
+    for (auto& mask : units_) mask.Reset(i);
+    units_[unit].Set(i);
+    return true;
+}
+
+ReservationStation::Unit ReservationStation::GetUnit(Instruction instruction) {
+    switch (instruction) {
+        case Instruction::ADD:
+        case Instruction::SUB:
+        case Instruction::ADDI:
+            return addUnit;
+        case Instruction::SLL:
+        case Instruction::SLLI:
+        case Instruction::SRL:
+        case Instruction::SRLI:
+        case Instruction::SRA:
+        case Instruction::SRAI:
+            return shiftUnit;
+        case Instruction::SLT:
+        case Instruction::SLTI:
+        case Instruction::SLTU:
+        case Instruction::SLTIU:
+        case Instruction::BEQ:
+        case Instruction::BNE:
+        case Instruction::BLT:
+        case Instruction::BGE:
+        case Instruction::BLTU:
+        case Instruction::BGEU:
+            return setUnit;
+        case Instruction::XOR:
+        case Instruction::XORI:
+        case Instruction::OR:
+        case Instruction::ORI:
+        case Instruction::AND:
+        case Instruction::ANDI:
+            return logicUnit;
+        default:
+            return unitCount;
     }
-    return false;
 }
 
 void ReservationStation::Clear() {
-    for (auto& i : nextEntries_) i.empty = true;
+    nextUsed_.Clear();
     for (auto& alu : addALU_) alu.Clear();
     for (auto& alu : shiftALU_) alu.Clear();
     for (auto& alu : setALU_) alu.Clear();
     for (auto& alu : logicALU_) alu.Clear();
 }
+
+void ReservationStation::Squash(BranchMask branch) {
+    nextUsed_.ForEach([&](SizeType i) {
+        if (entries_[i].branchMask & branch) nextUsed_.Reset(i);
+    });
+    auto squash = [&](ALU& alu) {
+        alu.Squash([&](SizeType i) { return (entries_[i].branchMask & branch) != 0; });
+    };
+    for (auto& alu : addALU_) squash(alu);
+    for (auto& alu : shiftALU_) squash(alu);
+    for (auto& alu : setALU_) squash(alu);
+    for (auto& alu : logicALU_) squash(alu);
+}
+
+void ReservationStation::ResolveBranches(BranchMask branches) {
+    nextUsed_.ForEach([&](SizeType i) { entries_[i].branchMask &= ~branches; });
+}
+
+void ReservationStation::PrintOccupancy(std::ostream& out) const {
+    if (cycles_ == 0) return;
+    auto percent = [&](SizeType count) {
+        return 100.0 * static_cast<double>(count) / static_cast<double>(cycles_);
+    };
+    out << "Reservation station occupancy: " << std::fixed << std::setprecision(2);
+    for (SizeType unit = 0; unit < unitCount; ++unit) {
+        out << (unit > 0 ? ", " : "") << kUnitNames[unit] << " "
+            << static_cast<double>(occupancy_[unit]) / static_cast<double>(cycles_);
+        if (split_) {
+            out << " of " << queues_[unit].Count() << " (full " << percent(fullCycles_[unit])
+                << "%)";
+        }
+    }
+    if (!split_) {
+        out << " of " << all_.Count() << " (full " << percent(fullCycles_[addUnit]) << "%)";
+    }
+    out << "." << std::endl;
+}
@@ -0,0 +1,76 @@
+// RISC-V Simulator
+// Copyright (C) 2022 Lau Yee-Yu
+//
+// This library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+
+#include "return_address_stack.h"
+
+void ReturnAddressStack::Stack::Push(WordType returnAddress) {
+    entries[top] = returnAddress;
+    top = (top + 1) % kDepth;
+    if (size < kDepth) ++size;
+}
+
+bool ReturnAddressStack::Stack::Pop(WordType& returnAddress) {
+    if (size == 0) return false;
+    top = (top - 1 + kDepth) % kDepth;
+    --size;
+    returnAddress = entries[top];
+    return true;
+}
+
+void ReturnAddressStack::Push(WordType returnAddress) { speculative_.Push(returnAddress); }
+
+bool ReturnAddressStack::Pop(WordType& returnAddress) { return speculative_.Pop(returnAddress); }
+
+void ReturnAddressStack::Commit(StackOperation operation, WordType returnAddress) {
+    WordType discarded;
+    switch (operation) {
+        case StackOperation::none:
+            break;
+        case StackOperation::push:
+            committed_.Push(returnAddress);
+            break;
+        case StackOperation::pop:
+            committed_.Pop(discarded);
+            break;
+        case StackOperation::popAndPush:
+            committed_.Pop(discarded);
+            committed_.Push(returnAddress);
+            break;
+    }
+}
+
+void ReturnAddressStack::Restore() { speculative_ = committed_; }
+
+ReturnAddressStack::Checkpoint ReturnAddressStack::Save() const {
+    return {speculative_};
+}
+
+void ReturnAddressStack::Restore(const Checkpoint& checkpoint) {
+    speculative_ = checkpoint.stack;
+}
+
+void ReturnAddressStack::Record(bool hit) {
+    if (hit) {
+        ++hits_;
+    } else {
+        ++misses_;
+    }
+}
+
+SizeType ReturnAddressStack::Hits() const { return hits_; }
+
+SizeType ReturnAddressStack::Misses() const { return misses_; }
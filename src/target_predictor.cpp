@@ -0,0 +1,68 @@
+// RISC-V Simulator
+// Copyright (C) 2022 Lau Yee-Yu
+//
+// This library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+
+#include "target_predictor.h"
+
+SizeType TargetPredictor::CacheIndex(WordType instructionAddress, WordType history) {
+    return ((instructionAddress >> 2) ^ history) & (kCacheSize - 1);
+}
+
+WordType TargetPredictor::NextHistory(WordType history, WordType target) {
+    return ((history << 2) ^ (target >> 2)) & ((1u << kHistoryBits) - 1);
+}
+
+bool TargetPredictor::Predict(WordType instructionAddress, WordType& target) const {
+    const Entry& cached = cache_[CacheIndex(instructionAddress, speculativeHistory_)];
+    if (cached.valid && cached.address == instructionAddress) {
+        target = cached.target;
+        return true;
+    }
+    const Entry& buffered = buffer_[(instructionAddress >> 2) & (kBufferSize - 1)];
+    if (buffered.valid && buffered.address == instructionAddress) {
+        target = buffered.target;
+        return true;
+    }
+    return false;
+}
+
+void TargetPredictor::Speculate(WordType target) {
+    speculativeHistory_ = NextHistory(speculativeHistory_, target);
+}
+
+void TargetPredictor::Restore() { speculativeHistory_ = history_; }
+
+WordType TargetPredictor::History() const { return speculativeHistory_; }
+
+void TargetPredictor::Restore(WordType history) { speculativeHistory_ = history; }
+
+void TargetPredictor::Update(WordType instructionAddress, WordType target) {
+    buffer_[(instructionAddress >> 2) & (kBufferSize - 1)] = {true, instructionAddress, target};
+    cache_[CacheIndex(instructionAddress, history_)] = {true, instructionAddress, target};
+    history_ = NextHistory(history_, target);
+}
+
+void TargetPredictor::Record(bool hit) {
+    if (hit) {
+        ++hits_;
+    } else {
+        ++misses_;
+    }
+}
+
+SizeType TargetPredictor::Hits() const { return hits_; }
+
+SizeType TargetPredictor::Misses() const { return misses_; }
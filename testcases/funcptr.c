@@ -0,0 +1,14 @@
+#include "io.inc"
+
+int add1(int x) { return x + 1; }
+int add3(int x) { return x + 3; }
+
+int (*op[2])(int) = {add1, add3};
+
+int main() {
+  int x = 0;
+  for (int i = 0; i < 100; ++i) x = op[0](x);      // the same function
+  for (int i = 0; i < 100; ++i) x = op[i & 1](x);  // alternating functions
+  printInt(x);
+  return judgeResult;  // 217
+}